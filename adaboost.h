@@ -2,11 +2,22 @@
 #define __adaboost_H__ 
 
 #include <sys/time.h>
+#include <float.h>
 #include <math.h>
+#include <unistd.h>
+#include "cache.h"
 #include "calloc_errchk.h"
 #include "diffSec.h"
 #include "io.h"
 #include "kmer.h"
+#include "kmer_count.h"
+#include "kmer_index.h"
+#include "numa.h"
+#include "presence.h"
+#include "shard.h"
+#include "simd.h"
+#include "thread_pool.h"
+#include "threshold.h"
 
 
 /* adaboost results*/
@@ -17,30 +28,213 @@ typedef struct _adaboost{
   unsigned int *sign;
 } adaboost;
 
-/* arguments for function adaboost_comp_err */
-typedef struct _adaboost_comp_err_args{
+/* positions of the four k-mers of a canonical k-mer pair in a bin bitmap */
+typedef struct _kp_pos {
+  presence_pos l1;
+  presence_pos m1;
+  presence_pos l2;
+  presence_pos m2;
+} kp_pos;
+
+
+/**
+ * anchor bin cursor for the bin-blocked (CSR) layout of hic:
+ *  presence of l1 and l2 in the anchor bin of the current rows
+ */
+typedef struct _csr_cursor {
+  /* first row of the next anchor bin */
+  unsigned long bin_end;
+  uint64_t a1;
+  uint64_t a2;
+} csr_cursor;
+
+static inline void csr_cursor_reset(csr_cursor *cur){
+  cur->bin_end = 0;
+  cur->a1 = 0;
+  cur->a2 = 0;
+}
+
+/* rows are processed in blocks of this size (a multiple of 64) */
+#define ADABOOST_ROW_BLOCK 4096
+
+/**
+ * incremental error update (--incremental)
+ *  errors are recomputed from scratch every ADABOOST_INCREMENTAL_REFRESH
+ *  rounds, or when more than N / ADABOOST_INCREMENTAL_MAX_FRACTION rows
+ *  changed their weight in the previous round
+ */
+#define ADABOOST_INCREMENTAL_REFRESH 64
+#define ADABOOST_INCREMENTAL_MAX_FRACTION 4
+
+/**
+ * k-mer pairs are handed out to the threads dynamically
+ * in chunks of this size
+ */
+#define ADABOOST_PAIR_CHUNK 64
+
+/**
+ * row-sampled search (--goss, a single dense model)
+ *  the candidates are scored on the rows with the largest weights plus
+ *  a random sample of the others (with importance weights), the winner
+ *  is re-scored on all rows. Every ADABOOST_GOSS_AUDIT rounds (or
+ *  --gossAudit) the exact search is run as well and its stamp is used.
+ */
+#define ADABOOST_GOSS_AUDIT 10
+
+typedef struct _adaboost_goss {
+  /* fraction of rows with the largest weights, sampling rate of the others */
+  double top;
+  double rate;
+  unsigned long audit;
+  /* sampled rows */
+  unsigned long N;
+  unsigned int *h_i;
+  unsigned int *h_j;
+  double *p;
+  uint64_t *ybits;
+  /* work array for the selection of the top rows */
+  double *tmp;
+  /* statistics */
+  unsigned long row_sum;
+  unsigned long rounds;
+  unsigned long audits;
+  unsigned long misses;
+} adaboost_goss;
+
+/**
+ * state of the current round of one model shared by the worker threads
+ * (several models for different percentiles are learned side by side)
+ */
+typedef struct _adaboost_round{
+  double wsum;
+  /* selected weak learner */
+  kp_pos pos;
+  unsigned int sign;
+  double beta;
+  /**
+   * incremental mode:
+   *  rows whose weight was multiplied by (1 + change_factor)
+   *  in the previous round: the correctly predicted ones if
+   *  change_correct != 0, the others otherwise
+   */
+  int change_correct;
+  double change_factor;
+  /**
+   * sparse mode (p1 also with --prune):
+   *  sum of p[x] over the rows with y[x] = 1, and the predictions
+   *  of the selected stamp (N bits)
+   */
+  double p1;
+  uint64_t *pred_bits;
+} adaboost_round;
+
+/* local argmin / argmax of the errors of one model */
+typedef struct _adaboost_best{
+  int found;
+  double min;
+  double max;
+  unsigned long argmin_lm;
+  unsigned long argmax_lm;
+} adaboost_best;
+
+/* arguments for the worker threads of adaboost_learn */
+typedef struct _adaboost_thread_args{
   /* thread specific info */
   int thread_id;
-  unsigned long begin;
-  unsigned long end;
+  /* row block slice [block_begin, block_end) */
+  unsigned long block_begin;
+  unsigned long block_end;
+  /* results of the local argmin / argmax, one per model */
+  adaboost_best *best;
+  /* errors of the current k-mer pair, one per model */
+  double *acc;
+  /* incremental mode: changed rows of this thread [change_begin, + change_num) */
+  unsigned long change_begin;
+  unsigned long change_num;
   /* shared param(s) */
   unsigned long N;
+  unsigned long pair_num;
+  unsigned int model_num;
+  unsigned long block_num;
+  /* number of 64-bit words of a row bit vector */
+  unsigned long nword;
+  /* k-mer pairs [pair_begin, pair_end) of this process (see --procs) */
+  unsigned long pair_begin;
+  unsigned long pair_end;
+  /* next k-mer pair chunk to be processed */
+  unsigned long *next_pair;
+  /* one per model */
+  adaboost_round *round;
   /* shared data */
-  const unsigned int **kmer_freq;
+  /* presence bitmap (NULL in sparse mode) */
+  const kmer_presence *presence;
+  /* sparse mode: k-mer profiles and their inverted index */
+  const kmer_count *kc;
+  const kmer_index *index;
+  unsigned long hic_bin_num;
   const unsigned int *h_i;
   const unsigned int *h_j;
-  /* array with 2^(4k-1) + 2^(2k-1) elements */
-  unsigned int *marked;
-  unsigned int *l1;
-  unsigned int *m1;
-  unsigned int *l2;
-  unsigned int *m2;
-  double **err;
+  /* row pointers of the CSR layout (NULL if hic is not blocked) */
+  const unsigned long *row_ptr;
+  const canonical_kp *kp;
+  /**
+   * the per-model arrays below are stored model after model:
+   *  marked, ybits, w, p, s, wsum_block and p1_block
+   */
+  /* bitset of 2^(4k-1) + 2^(2k-1) bits (see adaboost_marked_words) */
+  uint64_t *marked;
+  /* unnormalized errors (incremental mode only, NULL otherwise) */
+  double *err;
   /* array with N elements */
+  double *w;
   double *p;
-  unsigned int *y;
-} adaboost_comp_err_args;
-
+  /* sparse mode: s[x] = p[x] (1 - 2 y[x]) */
+  double *s;
+  /* array with N bits (packed into 64-bit words) */
+  uint64_t *ybits;
+  /* partial sums of w (and of p[x] y[x] in sparse mode), one per row block */
+  double *wsum_block;
+  double *p1_block;
+  /* incremental mode: changed rows and their weights before the change */
+  unsigned long *change_rows;
+  double *change_w;
+  unsigned long *change_total;
+  /**
+   * --prune (marginal is NULL otherwise):
+   *  marginal and bin_p hold the sums of p over the rows whose anchor
+   *  bin contains a k-mer (resp. is a bin) with y = 0 and y = 1, then
+   *  the same for the other bin: 4 x kmer_num (resp. 4 x kc->bin_num)
+   *  per model. The thread fills the k-mers [kmer_begin, kmer_end).
+   *  A pair is scanned only if its lower bound is at most prune[k].min
+   *  or its upper bound at least prune[k].max (up to prune_tol).
+   */
+  double *marginal;
+  const double *bin_p;
+  unsigned long kmer_begin;
+  unsigned long kmer_end;
+  const adaboost_best *prune;
+  double prune_tol;
+  /* statistics: pairs checked and pruned by this thread */
+  unsigned long prune_checked;
+  unsigned long prune_skipped;
+  /**
+   * --gemm (gemm_m is NULL otherwise):
+   *  the k-mer co-occurrence products M and D (kmer_num x kmer_num per
+   *  model), the presence of the reverse complements, the columns
+   *  [col_begin, col_end) of the products computed by the thread with
+   *  its work rows, and the range of the approximate errors
+   *  (the rounding margin is prune_tol)
+   */
+  double *gemm_m;
+  double *gemm_d;
+  const kmer_presence *presence_rc;
+  unsigned long col_begin;
+  unsigned long col_end;
+  double *gemm_row;
+  const adaboost_best *gemm_range;
+  /* statistics: pairs re-scored exactly by this thread */
+  unsigned long gemm_rescored;
+} adaboost_thread_args;
 
 int adaboost_show_itr(FILE *fp, 
 		      const adaboost *model,
@@ -49,24 +243,65 @@ int adaboost_show_itr(FILE *fp,
 		      const unsigned long t,
 		      double time);
 
+int adaboost_show_stamp(FILE *fp, 
+			const adaboost *model,
+			const char **kmer_strings,
+			const canonical_kp *kp,
+			const unsigned long t);
+
 int adaboost_show_all(FILE *fp, 
 		      const adaboost *model,
 		      const char **kmer_strings,
 		      const canonical_kp *kp);
 
+void *adaboost_thread_wsum(void *args);
+
+void *adaboost_thread_normalize(void *args);
+
+void *adaboost_thread_prune_marginals(void *args);
+
+void *adaboost_thread_prune_bounds(void *args);
+
+void *adaboost_thread_gemm(void *args);
+
+void *adaboost_thread_gemm_range(void *args);
+
+void *adaboost_thread_gemm_select(void *args);
+
 void *adaboost_comp_err(void *args);
 
+void *adaboost_thread_sparse_scores(void *args);
+
+void *adaboost_comp_err_sparse(void *args);
+
+void *adaboost_thread_update(void *args);
+
+void *adaboost_comp_err_incremental(void *args);
+
+void *adaboost_thread_count_changes(void *args);
+
+void *adaboost_thread_update_incremental(void *args);
+
 int adaboost_set_y(hic *hic,
 		   const double threshold,
 		   unsigned int **y);
 
+double adaboost_pair_err(const adaboost_thread_args *params,
+			 const unsigned int k,
+			 const unsigned long lm);
+
 int adaboost_learn(const command_line_arguements *cmd_args,
-		   const unsigned int **kmer_freq,
+		   thread_pool *pool,
+		   const kmer_presence *presence,
+		   const kmer_count *kc,
+		   const kmer_index *index,
 		   hic *hic,
-		   const double threshold,
+		   const unsigned int model_num,
+		   const double *threshold,
 		   const canonical_kp *kp,
 		   adaboost **model,
-		   const char *output_file);
+		   char **output_file,
+		   const char *checkpoint_file);
 
 
 int adaboost_show_itr(FILE *fp, 
@@ -75,63 +310,1174 @@ int adaboost_show_itr(FILE *fp,
 		      const canonical_kp *kp,
 		      const unsigned long t,
 		      double time){
+  const kp_tuple tp = kp_get(kp, (model->axis)[t]);
   fprintf(fp, "%ld\t%e\t%d\t%ld\t%s\t%s\t%s\t%s\t%f\t%f\n",
 	  t, 
 	  (model->beta)[t],
 	  (model->sign)[t],
 	  (model->axis)[t],
-	  kmer_strings[kp->l1[(model->axis)[t]]],
-	  kmer_strings[kp->m1[(model->axis)[t]]],
-	  kmer_strings[kp->l2[(model->axis)[t]]],
-	  kmer_strings[kp->m2[(model->axis)[t]]],
+	  kmer_strings[tp.l1],
+	  kmer_strings[tp.m1],
+	  kmer_strings[tp.l2],
+	  kmer_strings[tp.m2],
 	  time,
 	  time / (t + 1));
   return 0;
 }
 
+int adaboost_show_stamp(FILE *fp, 
+			const adaboost *model,
+			const char **kmer_strings,
+			const canonical_kp *kp,
+			const unsigned long t){
+  const kp_tuple tp = kp_get(kp, (model->axis)[t]);
+  fprintf(fp, "%ld\t%e\t%d\t%ld\t%s\t%s\t%s\t%s\n",
+	  t, 
+	  (model->beta)[t],
+	  (model->sign)[t],
+	  (model->axis)[t],
+	  kmer_strings[tp.l1],
+	  kmer_strings[tp.m1],
+	  kmer_strings[tp.l2],
+	  kmer_strings[tp.m2]);
+  return 0;
+}
+
 int adaboost_show_all(FILE *fp, 
 		      const adaboost *model,
 		      const char **kmer_strings,
 		      const canonical_kp *kp){
   unsigned long t;
   for(t = 0; t < model->T; t++){
-    fprintf(fp, "%ld\t%e\t%d\t%ld\t%s\t%s\t%s\t%s\n",
-	    t, 
-	    (model->beta)[t],
-	    (model->sign)[t],
-	    (model->axis)[t],
-	    kmer_strings[kp->l1[(model->axis)[t]]],
-	    kmer_strings[kp->m1[(model->axis)[t]]],
-	    kmer_strings[kp->l2[(model->axis)[t]]],
-	    kmer_strings[kp->m2[(model->axis)[t]]]);
+    adaboost_show_stamp(fp, model, kmer_strings, kp, t);
   }
   return 0;
 }
 		      
+static inline kp_pos kp_pos_of(const kp_tuple tp){
+  kp_pos pos;
+  pos.l1 = presence_pos_of(tp.l1);
+  pos.m1 = presence_pos_of(tp.m1);
+  pos.l2 = presence_pos_of(tp.l2);
+  pos.m2 = presence_pos_of(tp.m2);
+  return pos;
+}
+
+/**
+ * predictions of a weak learner for the (up to) 64 rows starting at x,
+ * bit b of the returned word corresponds to row x + b
+ */
+static inline uint64_t adaboost_pred_word(const kmer_presence *presence,
+					  const unsigned int *h_i,
+					  const unsigned int *h_j,
+					  const kp_pos *pos,
+					  const unsigned long x,
+					  const unsigned long N){
+  const unsigned long len =
+    (N - x < PRESENCE_WORD_BITS) ? N - x : PRESENCE_WORD_BITS;
+  const uint64_t *bi, *bj;
+  uint64_t pred = 0;
+  unsigned long b;
+  for(b = 0; b < len; b++){
+    bi = presence_bin(presence, h_i[x + b]);
+    bj = presence_bin(presence, h_j[x + b]);
+    pred |= ((((bi[pos->l1.word] >> pos->l1.shift) & 
+	       (bj[pos->m1.word] >> pos->m1.shift)) |
+	      ((bi[pos->l2.word] >> pos->l2.shift) & 
+	       (bj[pos->m2.word] >> pos->m2.shift))) & 1) << b;
+  }
+  return pred;
+}
+
+#ifdef SIMD_X86
+/**
+ * adaboost_pred_word for 64 rows, 2 rows at a time: without gathers the
+ * words are loaded one by one, but the shifts (the same for every row)
+ * and the combination of the four bits are vectorized
+ */
+SIMD_TARGET("sse4.2")
+static uint64_t adaboost_pred_word_sse42(const kmer_presence *presence,
+					 const unsigned int *h_i,
+					 const unsigned int *h_j,
+					 const kp_pos *pos){
+  const __m128i s_l1 = _mm_cvtsi32_si128(pos->l1.shift);
+  const __m128i s_m1 = _mm_cvtsi32_si128(pos->m1.shift);
+  const __m128i s_l2 = _mm_cvtsi32_si128(pos->l2.shift);
+  const __m128i s_m2 = _mm_cvtsi32_si128(pos->m2.shift);
+  const uint64_t *bi0, *bi1, *bj0, *bj1;
+  __m128i v;
+  uint64_t pred = 0;
+  unsigned int b;
+
+  for(b = 0; b < PRESENCE_WORD_BITS; b += 2){
+    bi0 = presence_bin(presence, h_i[b]);
+    bi1 = presence_bin(presence, h_i[b + 1]);
+    bj0 = presence_bin(presence, h_j[b]);
+    bj1 = presence_bin(presence, h_j[b + 1]);
+    v = _mm_or_si128(
+      _mm_and_si128(
+	_mm_srl_epi64(_mm_set_epi64x(bi1[pos->l1.word], bi0[pos->l1.word]), s_l1),
+	_mm_srl_epi64(_mm_set_epi64x(bj1[pos->m1.word], bj0[pos->m1.word]), s_m1)),
+      _mm_and_si128(
+	_mm_srl_epi64(_mm_set_epi64x(bi1[pos->l2.word], bi0[pos->l2.word]), s_l2),
+	_mm_srl_epi64(_mm_set_epi64x(bj1[pos->m2.word], bj0[pos->m2.word]), s_m2)));
+    pred |= (uint64_t)_mm_movemask_pd(_mm_castsi128_pd(_mm_slli_epi64(v, 63))) << b;
+  }
+  return pred;
+}
+
+/**
+ * adaboost_pred_word for 64 rows with gathers (4 rows at a time): the
+ * words of the four k-mers are loaded for each lane and their bits are
+ * combined with variable shifts
+ */
+SIMD_TARGET("avx2")
+static uint64_t adaboost_pred_word_avx2(const kmer_presence *presence,
+					const unsigned int *h_i,
+					const unsigned int *h_j,
+					const kp_pos *pos){
+  const long long *bits = (const long long *)presence->bits;
+  const __m256i nword = _mm256_set1_epi64x(presence->nword);
+  const __m256i w_l1 = _mm256_set1_epi64x(pos->l1.word);
+  const __m256i w_m1 = _mm256_set1_epi64x(pos->m1.word);
+  const __m256i w_l2 = _mm256_set1_epi64x(pos->l2.word);
+  const __m256i w_m2 = _mm256_set1_epi64x(pos->m2.word);
+  const __m256i s_l1 = _mm256_set1_epi64x(pos->l1.shift);
+  const __m256i s_m1 = _mm256_set1_epi64x(pos->m1.shift);
+  const __m256i s_l2 = _mm256_set1_epi64x(pos->l2.shift);
+  const __m256i s_m2 = _mm256_set1_epi64x(pos->m2.shift);
+  __m256i bi, bj, v;
+  uint64_t pred = 0;
+  unsigned int b;
+
+  for(b = 0; b < PRESENCE_WORD_BITS; b += 4){
+    bi = _mm256_mul_epu32(_mm256_cvtepu32_epi64(_mm_loadu_si128((const __m128i *)(h_i + b))),
+			  nword);
+    bj = _mm256_mul_epu32(_mm256_cvtepu32_epi64(_mm_loadu_si128((const __m128i *)(h_j + b))),
+			  nword);
+    v = _mm256_or_si256(
+      _mm256_and_si256(
+	_mm256_srlv_epi64(_mm256_i64gather_epi64(bits, _mm256_add_epi64(bi, w_l1), 8), s_l1),
+	_mm256_srlv_epi64(_mm256_i64gather_epi64(bits, _mm256_add_epi64(bj, w_m1), 8), s_m1)),
+      _mm256_and_si256(
+	_mm256_srlv_epi64(_mm256_i64gather_epi64(bits, _mm256_add_epi64(bi, w_l2), 8), s_l2),
+	_mm256_srlv_epi64(_mm256_i64gather_epi64(bits, _mm256_add_epi64(bj, w_m2), 8), s_m2)));
+    pred |= (uint64_t)_mm256_movemask_pd(_mm256_castsi256_pd(_mm256_slli_epi64(v, 63))) << b;
+  }
+  return pred;
+}
+
+/* same as adaboost_pred_word_avx2 with 8 rows at a time */
+SIMD_TARGET("avx512f")
+static uint64_t adaboost_pred_word_avx512(const kmer_presence *presence,
+					  const unsigned int *h_i,
+					  const unsigned int *h_j,
+					  const kp_pos *pos){
+  const __m512i nword = _mm512_set1_epi64(presence->nword);
+  const __m512i one = _mm512_set1_epi64(1);
+  const __m512i w_l1 = _mm512_set1_epi64(pos->l1.word);
+  const __m512i w_m1 = _mm512_set1_epi64(pos->m1.word);
+  const __m512i w_l2 = _mm512_set1_epi64(pos->l2.word);
+  const __m512i w_m2 = _mm512_set1_epi64(pos->m2.word);
+  const __m512i s_l1 = _mm512_set1_epi64(pos->l1.shift);
+  const __m512i s_m1 = _mm512_set1_epi64(pos->m1.shift);
+  const __m512i s_l2 = _mm512_set1_epi64(pos->l2.shift);
+  const __m512i s_m2 = _mm512_set1_epi64(pos->m2.shift);
+  __m512i bi, bj, v;
+  uint64_t pred = 0;
+  unsigned int b;
+
+  for(b = 0; b < PRESENCE_WORD_BITS; b += 8){
+    bi = _mm512_mul_epu32(_mm512_cvtepu32_epi64(_mm256_loadu_si256((const __m256i *)(h_i + b))),
+			  nword);
+    bj = _mm512_mul_epu32(_mm512_cvtepu32_epi64(_mm256_loadu_si256((const __m256i *)(h_j + b))),
+			  nword);
+    v = _mm512_or_si512(
+      _mm512_and_si512(
+	_mm512_srlv_epi64(_mm512_i64gather_epi64(_mm512_add_epi64(bi, w_l1), presence->bits, 8), s_l1),
+	_mm512_srlv_epi64(_mm512_i64gather_epi64(_mm512_add_epi64(bj, w_m1), presence->bits, 8), s_m1)),
+      _mm512_and_si512(
+	_mm512_srlv_epi64(_mm512_i64gather_epi64(_mm512_add_epi64(bi, w_l2), presence->bits, 8), s_l2),
+	_mm512_srlv_epi64(_mm512_i64gather_epi64(_mm512_add_epi64(bj, w_m2), presence->bits, 8), s_m2)));
+    pred |= (uint64_t)_mm512_test_epi64_mask(v, one) << b;
+  }
+  return pred;
+}
+#endif
+
+/**
+ * adaboost_pred_word with the vector kernel of simd_level
+ * (the last, partial word is done by the scalar code)
+ */
+static inline uint64_t adaboost_pred_word_simd(const kmer_presence *presence,
+					       const unsigned int *h_i,
+					       const unsigned int *h_j,
+					       const kp_pos *pos,
+					       const unsigned long x,
+					       const unsigned long N){
+#ifdef SIMD_X86
+  if(N - x >= PRESENCE_WORD_BITS){
+    switch(simd_level){
+      case SIMD_AVX512:
+	return adaboost_pred_word_avx512(presence, h_i + x, h_j + x, pos);
+      case SIMD_AVX2:
+	return adaboost_pred_word_avx2(presence, h_i + x, h_j + x, pos);
+      case SIMD_SSE42:
+	return adaboost_pred_word_sse42(presence, h_i + x, h_j + x, pos);
+    }
+  }
+#endif
+  return adaboost_pred_word(presence, h_i, h_j, pos, x, N);
+}
+
+/**
+ * same as adaboost_pred_word for the bin-blocked (CSR) layout:
+ *  the anchor bits are loaded once per anchor bin and rows of anchor bins
+ *  containing neither l1 nor l2 are skipped
+ *  (reset cur before the first call)
+ */
+static inline uint64_t adaboost_pred_word_csr(const kmer_presence *presence,
+					      const unsigned int *h_i,
+					      const unsigned int *h_j,
+					      const unsigned long *row_ptr,
+					      const kp_pos *pos,
+					      const unsigned long x,
+					      const unsigned long N,
+					      csr_cursor *cur){
+  const unsigned long len =
+    (N - x < PRESENCE_WORD_BITS) ? N - x : PRESENCE_WORD_BITS;
+  const uint64_t *bi, *bj;
+  uint64_t pred = 0;
+  unsigned long b;
+  for(b = 0; b < len; b++){
+    if(x + b >= cur->bin_end){
+      bi = presence_bin(presence, h_i[x + b]);
+      cur->a1 = (bi[pos->l1.word] >> pos->l1.shift) & 1;
+      cur->a2 = (bi[pos->l2.word] >> pos->l2.shift) & 1;
+      cur->bin_end = row_ptr[h_i[x + b] + 1];
+    }
+    if((cur->a1 | cur->a2) == 0){
+      /* jump to the last row of this anchor bin within the word */
+      b = ((cur->bin_end - x < len) ? cur->bin_end - x : len) - 1;
+      continue;
+    }
+    bj = presence_bin(presence, h_j[x + b]);
+    pred |= (((cur->a1 & (bj[pos->m1.word] >> pos->m1.shift)) |
+	      (cur->a2 & (bj[pos->m2.word] >> pos->m2.shift))) & 1) << b;
+  }
+  return pred;
+}
+
+/**
+ * same as adaboost_pred_word for the rows rows[0], ..., rows[len - 1]
+ * (len <= 64), the labels of the rows are returned in *ybits_word
+ */
+static inline uint64_t adaboost_pred_word_rows(const kmer_presence *presence,
+					       const unsigned int *h_i,
+					       const unsigned int *h_j,
+					       const uint64_t *ybits,
+					       const kp_pos *pos,
+					       const unsigned long *rows,
+					       const unsigned long len,
+					       uint64_t *ybits_word){
+  const uint64_t *bi, *bj;
+  uint64_t pred = 0, y = 0;
+  unsigned long b, x;
+  for(b = 0; b < len; b++){
+    x = rows[b];
+    bi = presence_bin(presence, h_i[x]);
+    bj = presence_bin(presence, h_j[x]);
+    pred |= ((((bi[pos->l1.word] >> pos->l1.shift) & 
+	       (bj[pos->m1.word] >> pos->m1.shift)) |
+	      ((bi[pos->l2.word] >> pos->l2.shift) & 
+	       (bj[pos->m2.word] >> pos->m2.shift))) & 1) << b;
+    y |= ((ybits[x >> PRESENCE_WORD_SHIFT] >> (x & PRESENCE_WORD_MASK)) & 1) << b;
+  }
+  *ybits_word = y;
+  return pred;
+}
+
+/* acc + sum of p[b] over the set bits b of mask (in increasing order of b) */
+static inline double adaboost_masked_sum(uint64_t mask,
+					 const double *p,
+					 double acc){
+  while(mask != 0){
+    acc += p[__builtin_ctzll(mask)];
+    mask &= mask - 1;
+  }
+  return acc;
+}
+
+/* partial sums of w over the row blocks of this thread */
+void *adaboost_thread_wsum(void *args){
+  adaboost_thread_args *params = (adaboost_thread_args *)args;
+  unsigned long block, x, x_end;
+  unsigned int k;
+  const double *w;
+  double sum;
+
+  for(k = 0; k < params->model_num; k++){
+    w = params->w + k * params->N;
+    for(block = params->block_begin; block < params->block_end; block++){
+      x_end = (block + 1) * ADABOOST_ROW_BLOCK;
+      if(x_end > params->N){
+	x_end = params->N;
+      }
+      sum = 0;
+      for(x = block * ADABOOST_ROW_BLOCK; x < x_end; x++){
+	sum += w[x];
+      }
+      (params->wsum_block)[k * params->block_num + block] = sum;
+    }
+  }
+  return NULL;
+}
+
+/* step 1 : compute normalized weights p[] */
+void *adaboost_thread_normalize(void *args){
+  adaboost_thread_args *params = (adaboost_thread_args *)args;
+  unsigned long x, x_end;
+  unsigned int k;
+  double wsum, *p;
+  const double *w;
+
+  x_end = params->block_end * ADABOOST_ROW_BLOCK;
+  if(x_end > params->N){
+    x_end = params->N;
+  }
+  for(k = 0; k < params->model_num; k++){
+    wsum = params->round[k].wsum;
+    w = params->w + k * params->N;
+    p = params->p + k * params->N;
+    for(x = params->block_begin * ADABOOST_ROW_BLOCK; x < x_end; x++){
+      p[x] = 1.0 * w[x] / wsum;
+    }
+  }
+  return NULL;
+}
+
+/**
+ * update the local argmin / argmax with err of k-mer pair lm
+ *  ties are broken by the rank of the pair in the original enumeration
+ *  (kp_lex_rank), so that the result does not depend on the order in
+ *  which pairs are visited and matches the earlier versions
+ */
+static inline void adaboost_thread_best(adaboost_best *best,
+					const canonical_kp *kp,
+					const double err,
+					const unsigned long lm){
+  if(best->found == 0){
+    best->found = 1;
+    best->min = best->max = err;
+    best->argmin_lm = best->argmax_lm = lm;
+    return;
+  }
+  if(err < best->min ||
+     (err == best->min &&
+      kp_lex_rank(kp, lm) < kp_lex_rank(kp, best->argmin_lm))){
+    best->min = err;
+    best->argmin_lm = lm;
+  }
+  if(err > best->max ||
+     (err == best->max &&
+      kp_lex_rank(kp, lm) < kp_lex_rank(kp, best->argmax_lm))){
+    best->max = err;
+    best->argmax_lm = lm;
+  }
+}
+
+/* words of the bitset of used pairs of one model */
+static inline unsigned long adaboost_marked_words(const unsigned long pair_num){
+  return (pair_num + 63) >> 6;
+}
+
+/* mark k-mer pair lm as used (or filtered out) for model k */
+static inline void adaboost_mark(uint64_t *marked,
+				 const unsigned long pair_num,
+				 const unsigned int k,
+				 const unsigned long lm){
+  marked[k * adaboost_marked_words(pair_num) + (lm >> 6)] |= (uint64_t)1 << (lm & 63);
+}
+
+static inline int adaboost_marked_bit(const uint64_t *marked,
+				      const unsigned long pair_num,
+				      const unsigned int k,
+				      const unsigned long lm){
+  return (marked[k * adaboost_marked_words(pair_num) + (lm >> 6)] >> (lm & 63)) & 1;
+}
+
+/* 1 if k-mer pair lm is already used (or filtered out) for model k */
+static inline int adaboost_marked(const adaboost_thread_args *params,
+				  const unsigned int k,
+				  const unsigned long lm){
+  return adaboost_marked_bit(params->marked, params->pair_num, k, lm);
+}
+
+/* grab the next chunk [*begin, *end) of k-mer pairs, returns 0 if none left */
+static inline int adaboost_next_chunk(adaboost_thread_args *params,
+				      unsigned long *begin,
+				      unsigned long *end){
+  *begin = __sync_fetch_and_add(params->next_pair, ADABOOST_PAIR_CHUNK);
+  if(*begin >= params->pair_end){
+    return 0;
+  }
+  *end = ((*begin + ADABOOST_PAIR_CHUNK < params->pair_end) ?
+	  *begin + ADABOOST_PAIR_CHUNK : params->pair_end);
+  return 1;
+}
+
+/**
+ * merge a local argmin / argmax into dst (same tie breaking as
+ * adaboost_thread_best, so the order of the merges does not matter)
+ */
+static inline void adaboost_merge_best(adaboost_best *dst,
+				       const canonical_kp *kp,
+				       const adaboost_best *src){
+  if(src->found == 0){
+    return;
+  }else if(dst->found == 0){
+    *dst = *src;
+    return;
+  }
+  if(src->min < dst->min ||
+     (src->min == dst->min &&
+      kp_lex_rank(kp, src->argmin_lm) < kp_lex_rank(kp, dst->argmin_lm))){
+    dst->min = src->min;
+    dst->argmin_lm = src->argmin_lm;
+  }
+  if(src->max > dst->max ||
+     (src->max == dst->max &&
+      kp_lex_rank(kp, src->argmax_lm) < kp_lex_rank(kp, dst->argmax_lm))){
+    dst->max = src->max;
+    dst->argmax_lm = src->argmax_lm;
+  }
+}
+
+/**
+ * branch and bound (--prune)
+ *  the error of a weak learner is P1 + (sum of p over the rows it
+ *  predicts 1 with y = 0) - (the same with y = 1), where P1 is the sum
+ *  of p over the rows with y = 1. The rows predicted 1 by (l1, m1, l2, m2)
+ *  have l1 in the anchor bin and m1 in the other bin (or l2 and m2), so
+ *  either sum is at most min(A(l1), B(m1)) + min(A(l2), B(m2)) where
+ *  A(l) (resp. B(m)) is the sum over the rows whose anchor (resp. other)
+ *  bin contains l (resp. m). This gives cheap lower / upper bounds.
+ *  The smallest upper bound and the largest lower bound over the pairs
+ *  bound the min / max of the round, and a pair that can reach neither
+ *  is skipped. The argmin / argmax (and the ties among them) are never
+ *  skipped, so the stamps are the same as without pruning.
+ */
+
+/* sums of p per bin (see adaboost_thread_args), and P1 in dense mode */
+void adaboost_prune_bins(const adaboost_thread_args *params,
+			 double *bin_p){
+  const unsigned long bin_num = params->kc->bin_num;
+  unsigned long x;
+  unsigned int k;
+  uint64_t y;
+  const double *p;
+  double p1, *bins;
+
+  memset(bin_p, 0, params->model_num * 4 * bin_num * sizeof(double));
+  for(k = 0; k < params->model_num; k++){
+    p = params->p + k * params->N;
+    bins = bin_p + k * 4 * bin_num;
+    p1 = 0;
+    for(x = 0; x < params->N; x++){
+      y = ((params->ybits)[k * params->nword + (x >> PRESENCE_WORD_SHIFT)] >>
+	   (x & PRESENCE_WORD_MASK)) & 1;
+      bins[y * bin_num + (params->h_i)[x]] += p[x];
+      bins[(2 + y) * bin_num + (params->h_j)[x]] += p[x];
+      if(y){
+	p1 += p[x];
+      }
+    }
+    if(params->presence != NULL){
+      params->round[k].p1 = p1;
+    }
+  }
+}
+
+/* sums of p per k-mer for the k-mers [kmer_begin, kmer_end) */
+void *adaboost_thread_prune_marginals(void *args){
+  adaboost_thread_args *params = (adaboost_thread_args *)args;
+  const unsigned long kmer_num = params->kp->kmer_num;
+  const unsigned long bin_num = params->kc->bin_num;
+  unsigned long kmer, bin, word, e;
+  unsigned int k, j;
+  const uint64_t *bits;
+  uint64_t set;
+
+  for(k = 0; k < params->model_num; k++){
+    for(j = 0; j < 4; j++){
+      for(kmer = params->kmer_begin; kmer < params->kmer_end; kmer++){
+	(params->marginal)[(k * 4 + j) * kmer_num + kmer] = 0;
+      }
+    }
+  }
+  if(params->presence == NULL){
+    /* sparse mode: posting lists of the k-mers */
+    for(kmer = params->kmer_begin; kmer < params->kmer_end; kmer++){
+      for(e = params->index->ptr[kmer]; e < params->index->ptr[kmer + 1]; e++){
+	bin = params->index->bins[e];
+	for(k = 0; k < params->model_num; k++){
+	  for(j = 0; j < 4; j++){
+	    (params->marginal)[(k * 4 + j) * kmer_num + kmer] +=
+	      (params->bin_p)[(k * 4 + j) * bin_num + bin];
+	  }
+	}
+      }
+    }
+    return NULL;
+  }
+  /* dense mode: the slice is a range of bitmap words */
+  for(bin = 0; bin < bin_num; bin++){
+    bits = presence_bin(params->presence, bin);
+    for(word = params->kmer_begin >> PRESENCE_WORD_SHIFT;
+	(word << PRESENCE_WORD_SHIFT) < params->kmer_end; word++){
+      for(set = bits[word]; set != 0; set &= set - 1){
+	kmer = (word << PRESENCE_WORD_SHIFT) + __builtin_ctzll(set);
+	for(k = 0; k < params->model_num; k++){
+	  for(j = 0; j < 4; j++){
+	    (params->marginal)[(k * 4 + j) * kmer_num + kmer] +=
+	      (params->bin_p)[(k * 4 + j) * bin_num + bin];
+	  }
+	}
+      }
+    }
+  }
+  return NULL;
+}
+
+/* lower / upper bound of the error of the pair tp for model k */
+static inline void adaboost_prune_range(const adaboost_thread_args *params,
+					const unsigned int k,
+					const kp_tuple tp,
+					double *lb,
+					double *ub){
+  const unsigned long kmer_num = params->kp->kmer_num;
+  const double *a0 = params->marginal + k * 4 * kmer_num;
+  const double *a1 = a0 + kmer_num, *b0 = a1 + kmer_num, *b1 = b0 + kmer_num;
+  double u0 = fmin(a0[tp.l1], b0[tp.m1]), u1 = fmin(a1[tp.l1], b1[tp.m1]);
+
+  /* (l1, m1) = (l2, m2) for the pairs (l, l) */
+  if(tp.l1 != tp.l2 || tp.m1 != tp.m2){
+    u0 += fmin(a0[tp.l2], b0[tp.m2]);
+    u1 += fmin(a1[tp.l2], b1[tp.m2]);
+  }
+  *lb = params->round[k].p1 - u1;
+  *ub = params->round[k].p1 + u0;
+}
+
+/**
+ * smallest upper bound (best[k].min) and largest lower bound
+ * (best[k].max) over the unmarked pairs
+ */
+void *adaboost_thread_prune_bounds(void *args){
+  adaboost_thread_args *params = (adaboost_thread_args *)args;
+  unsigned long kmerpair, begin, end;
+  unsigned int k;
+  adaboost_best *best;
+  kp_tuple tp;
+  double lb, ub;
+
+  for(k = 0; k < params->model_num; k++){
+    params->best[k].found = 0;
+  }
+  while(adaboost_next_chunk(params, &begin, &end) != 0){
+    for(kmerpair = begin; kmerpair < end; kmerpair++){
+      tp = kp_get(params->kp, kmerpair);
+      for(k = 0; k < params->model_num; k++){
+	if(adaboost_marked(params, k, kmerpair) != 0){
+	  continue;
+	}
+	adaboost_prune_range(params, k, tp, &lb, &ub);
+	best = &(params->best[k]);
+	if(best->found == 0){
+	  best->found = 1;
+	  best->min = ub;
+	  best->max = lb;
+	  best->argmin_lm = best->argmax_lm = kmerpair;
+	}else{
+	  best->min = fmin(best->min, ub);
+	  best->max = fmax(best->max, lb);
+	}
+      }
+    }
+  }
+  return NULL;
+}
+
+/**
+ * 1 if pair lm can be skipped: for every model it is marked or its
+ * bounds show that it is neither the argmin nor the argmax (the local
+ * results of the thread tighten the bounds of the round)
+ */
+static inline int adaboost_pruned(adaboost_thread_args *params,
+				  const unsigned long lm){
+  const kp_tuple tp = kp_get(params->kp, lm);
+  const adaboost_best *best;
+  unsigned int k;
+  double lb, ub, min, max;
+
+  params->prune_checked++;
+  for(k = 0; k < params->model_num; k++){
+    if(adaboost_marked(params, k, lm) != 0){
+      continue;
+    }
+    best = &(params->best[k]);
+    min = params->prune[k].min;
+    max = params->prune[k].max;
+    if(best->found != 0){
+      min = fmin(min, best->min);
+      max = fmax(max, best->max);
+    }
+    adaboost_prune_range(params, k, tp, &lb, &ub);
+    if(lb <= min + params->prune_tol || ub >= max - params->prune_tol){
+      return 0;
+    }
+  }
+  params->prune_skipped++;
+  return 1;
+}
+
+/**
+ * co-occurrence engine (--gemm, dense mode with bin-blocked Hi-C data)
+ *  with s[x] = p[x] (1 - 2 y[x]) and P1 the sum of p over the rows with
+ *  y = 1, the error of the pair (l, c), i.e. (l, rc(c), c, rc(l)), is
+ *    P1 + M[l][c] + M[c][l] - D[l][c]
+ *  where M = P^T S R (S: bin x bin matrix of the scores, P: bin x k-mer
+ *  presence, R[j][c]: presence of rc(c) in bin j) and D[l][c] is the sum
+ *  of s over the rows predicted by both halves of the pair.
+ *  For each anchor bin, the row of S R is accumulated from the rows of
+ *  the bin and added to the rows of M of the k-mers of the bin; D gets a
+ *  rank-1 update per row. Each thread owns a slice of the columns, which
+ *  stays in cache, and its sums do not depend on the number of threads.
+ *  The products are rounded differently from adaboost_comp_err, so the
+ *  pairs within the rounding margin of the min / max are re-scored
+ *  exactly and the stamps are the same.
+ */
+
+/* bits of word w of a bitmap that lie in [begin, end) */
+static inline uint64_t adaboost_slice_word(const uint64_t word,
+					   const unsigned long w,
+					   const unsigned long begin,
+					   const unsigned long end){
+  const unsigned long lo = w << PRESENCE_WORD_SHIFT;
+  uint64_t mask = ~(uint64_t)0;
+  if(begin > lo){
+    mask &= ~(uint64_t)0 << (begin - lo);
+  }
+  if(end < lo + PRESENCE_WORD_BITS){
+    mask &= ((uint64_t)1 << (end - lo)) - 1;
+  }
+  return word & mask;
+}
+
+/* columns [col_begin, col_end) of M and D */
+void *adaboost_thread_gemm(void *args){
+  adaboost_thread_args *params = (adaboost_thread_args *)args;
+  const unsigned long kmer_num = params->kp->kmer_num;
+  const unsigned long c0 = params->col_begin, c1 = params->col_end;
+  const unsigned long cw = c1 - c0, nword = params->presence->nword;
+  const unsigned int model_num = params->model_num;
+  double *t = params->gemm_row, *v = params->gemm_row + model_num * cw;
+  unsigned long bin, x, w, l, c, from;
+  unsigned int k;
+  const uint64_t *bi, *bj;
+  uint64_t set;
+  double sx, *row;
+
+  if(cw == 0){
+    return NULL;
+  }
+  for(k = 0; k < model_num; k++){
+    for(l = 0; l < kmer_num; l++){
+      memset(params->gemm_m + (k * kmer_num + l) * kmer_num + c0, 0,
+	     cw * sizeof(double));
+      memset(params->gemm_d + (k * kmer_num + l) * kmer_num + c0, 0,
+	     cw * sizeof(double));
+    }
+  }
+  for(bin = 0; bin < params->hic_bin_num; bin++){
+    if(params->row_ptr[bin] == params->row_ptr[bin + 1]){
+      continue;
+    }
+    bi = presence_bin(params->presence, bin);
+    memset(t, 0, model_num * cw * sizeof(double));
+    for(x = params->row_ptr[bin]; x < params->row_ptr[bin + 1]; x++){
+      bj = presence_bin(params->presence_rc, params->h_j[x]);
+      /* row of S R */
+      memset(v, 0, cw * sizeof(double));
+      for(w = c0 >> PRESENCE_WORD_SHIFT; (w << PRESENCE_WORD_SHIFT) < c1; w++){
+	for(set = adaboost_slice_word(bj[w], w, c0, c1); set != 0; set &= set - 1){
+	  c = (w << PRESENCE_WORD_SHIFT) + __builtin_ctzll(set) - c0;
+	  for(k = 0; k < model_num; k++){
+	    t[k * cw + c] += (params->s)[k * params->N + x];
+	  }
+	  v[c] = ((bi[w] >> ((c + c0) & PRESENCE_WORD_MASK)) & 1);
+	}
+      }
+      /* rank-1 update of D with the k-mers of both halves */
+      for(w = 0; w < nword && (w << PRESENCE_WORD_SHIFT) < c1; w++){
+	for(set = bi[w] & bj[w]; set != 0; set &= set - 1){
+	  l = (w << PRESENCE_WORD_SHIFT) + __builtin_ctzll(set);
+	  if(l >= c1){
+	    break;
+	  }
+	  from = (l > c0) ? l : c0;
+	  for(k = 0; k < model_num; k++){
+	    sx = (params->s)[k * params->N + x];
+	    row = params->gemm_d + (k * kmer_num + l) * kmer_num;
+	    simd_axpy(row + from, v + (from - c0), sx, c1 - from);
+	  }
+	}
+      }
+    }
+    /* rows of M of the k-mers of the anchor bin */
+    for(w = 0; w < nword; w++){
+      for(set = bi[w]; set != 0; set &= set - 1){
+	l = (w << PRESENCE_WORD_SHIFT) + __builtin_ctzll(set);
+	for(k = 0; k < model_num; k++){
+	  row = params->gemm_m + (k * kmer_num + l) * kmer_num + c0;
+	  simd_axpy(row, t + k * cw, 1.0, cw);
+	}
+      }
+    }
+  }
+  return NULL;
+}
+
+/* error of pair (l, c) of model k from the products */
+static inline double adaboost_gemm_err(const adaboost_thread_args *params,
+				       const unsigned int k,
+				       const kp_tuple tp){
+  const unsigned long kmer_num = params->kp->kmer_num;
+  const double *m = params->gemm_m + k * kmer_num * kmer_num;
+  const double *d = params->gemm_d + k * kmer_num * kmer_num;
+  return (params->round[k].p1 + m[tp.l1 * kmer_num + tp.l2] +
+	  m[tp.l2 * kmer_num + tp.l1] - d[tp.l1 * kmer_num + tp.l2]);
+}
+
+/* local min / max of the approximate errors */
+void *adaboost_thread_gemm_range(void *args){
+  adaboost_thread_args *params = (adaboost_thread_args *)args;
+  unsigned long kmerpair, begin, end;
+  unsigned int k;
+  kp_tuple tp;
+
+  for(k = 0; k < params->model_num; k++){
+    params->best[k].found = 0;
+  }
+  while(adaboost_next_chunk(params, &begin, &end) != 0){
+    for(kmerpair = begin; kmerpair < end; kmerpair++){
+      tp = kp_get(params->kp, kmerpair);
+      for(k = 0; k < params->model_num; k++){
+	if(adaboost_marked(params, k, kmerpair) == 0){
+	  adaboost_thread_best(&(params->best[k]), params->kp,
+			       adaboost_gemm_err(params, k, tp), kmerpair);
+	}
+      }
+    }
+  }
+  return NULL;
+}
+
+/**
+ * local argmin / argmax: the pairs whose approximate error is within
+ * the rounding margin of the min / max are re-scored exactly
+ */
+void *adaboost_thread_gemm_select(void *args){
+  adaboost_thread_args *params = (adaboost_thread_args *)args;
+  const double margin = 2 * params->prune_tol;
+  unsigned long kmerpair, begin, end;
+  unsigned int k;
+  kp_tuple tp;
+  double err;
+
+  for(k = 0; k < params->model_num; k++){
+    params->best[k].found = 0;
+  }
+  while(adaboost_next_chunk(params, &begin, &end) != 0){
+    for(kmerpair = begin; kmerpair < end; kmerpair++){
+      tp = kp_get(params->kp, kmerpair);
+      for(k = 0; k < params->model_num; k++){
+	if(adaboost_marked(params, k, kmerpair) != 0){
+	  continue;
+	}
+	err = adaboost_gemm_err(params, k, tp);
+	if(err <= params->gemm_range[k].min + margin ||
+	   err >= params->gemm_range[k].max - margin){
+	  adaboost_thread_best(&(params->best[k]), params->kp,
+			       adaboost_pair_err(params, k, kmerpair), kmerpair);
+	  params->gemm_rescored++;
+	}
+      }
+    }
+  }
+  return NULL;
+}
+
+/**
+ * step 2 : compute err for each k-mer pair
+ *  and find the local argmin / argmax among the unmarked ones.
+ *  The prediction of a pair is computed once per 64 rows and the
+ *  errors of all models are accumulated from it.
+ */
 void *adaboost_comp_err(void *args){
-  adaboost_comp_err_args *params = (adaboost_comp_err_args *)args;
-  unsigned int kmerpair = 0, x = 0, pred;
- 
-  for(kmerpair = params->begin; kmerpair <= params->end; kmerpair++){
-    (*(params->err))[kmerpair] = 0;
+  adaboost_thread_args *params = (adaboost_thread_args *)args;
+  unsigned long kmerpair = 0, x = 0, begin, end;
+  unsigned int k, active;
+  uint64_t pred;
+  csr_cursor cur;
+  kp_pos pos;
+
+  for(k = 0; k < params->model_num; k++){
+    params->best[k].found = 0;
   }
-  for(kmerpair = params->begin; kmerpair <= params->end; kmerpair++){
-    if(params->marked[kmerpair] == 0){
-      for(x = 0; x < params->N; x++){
-	pred = 
-	  (params->kmer_freq)[(params->h_i)[x]][(params->l1)[kmerpair]] * 
-	  (params->kmer_freq)[(params->h_j)[x]][(params->m1)[kmerpair]] +
-	  (params->kmer_freq)[(params->h_i)[x]][(params->l2)[kmerpair]] * 
-	  (params->kmer_freq)[(params->h_j)[x]][(params->m2)[kmerpair]];
-	if((params->y)[x] != (pred > 0 ? 1 : 0)){
-	  (*(params->err))[kmerpair] += (params->p)[x];
+  while(adaboost_next_chunk(params, &begin, &end) != 0){
+    for(kmerpair = begin; kmerpair < end; kmerpair++){
+      active = 0;
+      for(k = 0; k < params->model_num; k++){
+	active += (adaboost_marked(params, k, kmerpair) == 0);
+	(params->acc)[k] = 0;
+      }
+      if(active == 0){
+	if(params->err != NULL){
+	  (params->err)[kmerpair] = 0;
 	}
+	continue;
+      }
+      if(params->marginal != NULL && adaboost_pruned(params, kmerpair) != 0){
+	continue;
+      }
+      pos = kp_pos_of(kp_get(params->kp, kmerpair));
+      csr_cursor_reset(&cur);
+      for(x = 0; x < params->N; x += PRESENCE_WORD_BITS){
+	if(params->row_ptr != NULL){
+	  pred = adaboost_pred_word_csr(params->presence,
+					params->h_i, params->h_j,
+					params->row_ptr,
+					&pos, x, params->N, &cur);
+	}else{
+	  pred = adaboost_pred_word_simd(params->presence,
+					 params->h_i, params->h_j,
+					 &pos, x, params->N);
+	}
+	for(k = 0; k < params->model_num; k++){
+	  if(adaboost_marked(params, k, kmerpair) == 0){
+	    (params->acc)[k] =
+	      adaboost_masked_sum(pred ^ (params->ybits)[k * params->nword +
+							  (x >> PRESENCE_WORD_SHIFT)],
+				  &((params->p)[k * params->N + x]),
+				  (params->acc)[k]);
+	  }
+	}
+      }
+      for(k = 0; k < params->model_num; k++){
+	if(adaboost_marked(params, k, kmerpair) == 0){
+	  adaboost_thread_best(&(params->best[k]), params->kp,
+			       (params->acc)[k], kmerpair);
+	}
+      }
+      if(params->err != NULL){
+	(params->err)[kmerpair] = (params->acc)[0];
       }
     }
   }  
   return NULL;
 }
 
+/**
+ * sparse mode : scores s[x] = p[x] (1 - 2 y[x]) and the partial sums
+ *  of p[x] y[x] over the row blocks of this thread. The error of a weak
+ *  learner is then the sum of p over the rows with y = 1 plus the sum
+ *  of s over the rows it predicts 1.
+ */
+void *adaboost_thread_sparse_scores(void *args){
+  adaboost_thread_args *params = (adaboost_thread_args *)args;
+  unsigned long block, x, x_end;
+  unsigned int k;
+  const uint64_t *ybits;
+  const double *p;
+  double sum, *s;
+  uint64_t y;
+
+  for(k = 0; k < params->model_num; k++){
+    ybits = params->ybits + k * params->nword;
+    p = params->p + k * params->N;
+    s = params->s + k * params->N;
+    for(block = params->block_begin; block < params->block_end; block++){
+      x_end = (block + 1) * ADABOOST_ROW_BLOCK;
+      if(x_end > params->N){
+	x_end = params->N;
+      }
+      sum = 0;
+      for(x = block * ADABOOST_ROW_BLOCK; x < x_end; x++){
+	y = (ybits[x >> PRESENCE_WORD_SHIFT] >> (x & PRESENCE_WORD_MASK)) & 1;
+	s[x] = y ? -p[x] : p[x];
+	if(y){
+	  sum += p[x];
+	}
+      }
+      (params->p1_block)[k * params->block_num + block] = sum;
+    }
+  }
+  return NULL;
+}
+
+/**
+ * sparse mode : walk the rows predicted 1 by the weak learner
+ *  (l1, m1, l2, m2), i.e. the rows whose anchor bin contains l1
+ *  (resp. l2) and whose other bin contains m1 (resp. m2).
+ *  The anchor bins are the union of the posting lists of l1 and l2;
+ *  the other bin is looked up in its sorted profile.
+ *  Adds the sums of s over these rows to acc (one per model), or sets
+ *  their bits in pred_bits if it is not NULL.
+ */
+static inline void adaboost_sparse_walk(const adaboost_thread_args *params,
+					const kp_tuple tp,
+					double *acc,
+					uint64_t *pred_bits){
+  const kmer_index *index = params->index;
+  const uint32_t *b1 = index->bins + index->ptr[tp.l1];
+  const uint32_t *e1 = index->bins + index->ptr[tp.l1 + 1];
+  const uint32_t *b2 = index->bins + index->ptr[tp.l2];
+  const uint32_t *e2 = index->bins + index->ptr[tp.l2 + 1];
+  unsigned long bin, x;
+  unsigned int k;
+  int a1, a2;
+
+  while(b1 < e1 || b2 < e2){
+    if(b2 == e2 || (b1 < e1 && *b1 < *b2)){
+      bin = *(b1++);
+      a1 = 1;
+      a2 = 0;
+    }else if(b1 == e1 || *b2 < *b1){
+      bin = *(b2++);
+      a1 = 0;
+      a2 = 1;
+    }else{
+      bin = *b1;
+      b1++;
+      b2++;
+      a1 = a2 = 1;
+    }
+    if(bin >= params->hic_bin_num){
+      break;
+    }
+    for(x = params->row_ptr[bin]; x < params->row_ptr[bin + 1]; x++){
+      if((a1 && kmer_count_find(params->kc, params->h_j[x], tp.m1) >= 0) ||
+	 (a2 && kmer_count_find(params->kc, params->h_j[x], tp.m2) >= 0)){
+	if(pred_bits != NULL){
+	  pred_bits[x >> PRESENCE_WORD_SHIFT] |=
+	    (uint64_t)1 << (x & PRESENCE_WORD_MASK);
+	}else{
+	  for(k = 0; k < params->model_num; k++){
+	    acc[k] += (params->s)[k * params->N + x];
+	  }
+	}
+      }
+    }
+  }
+}
+
+/* step 2 (sparse mode) : compute err for each k-mer pair */
+void *adaboost_comp_err_sparse(void *args){
+  adaboost_thread_args *params = (adaboost_thread_args *)args;
+  unsigned long kmerpair = 0, begin, end;
+  unsigned int k, active;
+
+  for(k = 0; k < params->model_num; k++){
+    params->best[k].found = 0;
+  }
+  while(adaboost_next_chunk(params, &begin, &end) != 0){
+    for(kmerpair = begin; kmerpair < end; kmerpair++){
+      active = 0;
+      for(k = 0; k < params->model_num; k++){
+	active += (adaboost_marked(params, k, kmerpair) == 0);
+	(params->acc)[k] = 0;
+      }
+      if(active == 0 ||
+	 (params->marginal != NULL && adaboost_pruned(params, kmerpair) != 0)){
+	continue;
+      }
+      adaboost_sparse_walk(params, kp_get(params->kp, kmerpair),
+			   params->acc, NULL);
+      for(k = 0; k < params->model_num; k++){
+	if(adaboost_marked(params, k, kmerpair) == 0){
+	  adaboost_thread_best(&(params->best[k]), params->kp,
+			       params->round[k].p1 + (params->acc)[k], kmerpair);
+	}
+      }
+    }
+  }  
+  return NULL;
+}
+
+/**
+ * rows where the prediction (with sign) of the stamp selected for
+ * model k is correct (reset cur before the first call)
+ */
+static inline uint64_t adaboost_correct_word(const adaboost_thread_args *params,
+					     const unsigned int k,
+					     const unsigned long x,
+					     csr_cursor *cur){
+  const adaboost_round *round = &(params->round[k]);
+  uint64_t correct;
+  if(params->presence == NULL){
+    correct = (round->pred_bits)[x >> PRESENCE_WORD_SHIFT];
+  }else if(params->row_ptr != NULL){
+    correct = adaboost_pred_word_csr(params->presence, params->h_i, params->h_j,
+				     params->row_ptr, &(round->pos),
+				     x, params->N, cur);
+  }else{
+    correct = adaboost_pred_word_simd(params->presence, params->h_i, params->h_j,
+				      &(round->pos), x, params->N);
+  }
+  correct ^= (params->ybits)[k * params->nword + (x >> PRESENCE_WORD_SHIFT)];
+  if(round->sign == 0){
+    correct = ~correct;
+    if(params->N - x < PRESENCE_WORD_BITS){
+      correct &= ((uint64_t)1 << (params->N - x)) - 1;
+    }
+  }
+  return correct;
+}
+
+/**
+ * step 3 : compute new weights
+ *  and the partial sums of w for the next round
+ */
+void *adaboost_thread_update(void *args){
+  adaboost_thread_args *params = (adaboost_thread_args *)args;
+  unsigned long x, x_end;
+  unsigned int k;
+  uint64_t correct;
+  csr_cursor cur;
+  double *w;
+
+  x_end = params->block_end * ADABOOST_ROW_BLOCK;
+  if(x_end > params->N){
+    x_end = params->N;
+  }
+  for(k = 0; k < params->model_num; k++){
+    w = params->w + k * params->N;
+    csr_cursor_reset(&cur);
+    for(x = params->block_begin * ADABOOST_ROW_BLOCK; 
+	x < x_end; x += PRESENCE_WORD_BITS){
+      correct = adaboost_correct_word(params, k, x, &cur);
+      if(x + PRESENCE_WORD_BITS <= x_end){
+	simd_scale_masked(w + x, correct, params->round[k].beta);
+      }else{
+	while(correct != 0){
+	  w[x + __builtin_ctzll(correct)] *= params->round[k].beta;
+	  correct &= correct - 1;
+	}
+      }
+    }
+  }
+
+  adaboost_thread_wsum(args);
+  return NULL;
+}
+
+/**
+ * step 2 (incremental mode) : update the unnormalized err of each
+ *  k-mer pair with the rows changed in the previous round
+ *  and find the local argmin / argmax (a single model)
+ */
+void *adaboost_comp_err_incremental(void *args){
+  adaboost_thread_args *params = (adaboost_thread_args *)args;
+  const unsigned long change_total = *(params->change_total);
+  unsigned long kmerpair = 0, c = 0, len, begin, end;
+  uint64_t pred, y;
+  kp_pos pos;
+  double delta;
+
+  params->best[0].found = 0;
+  while(adaboost_next_chunk(params, &begin, &end) != 0){
+    for(kmerpair = begin; kmerpair < end; kmerpair++){
+      if(adaboost_marked(params, 0, kmerpair) == 0){
+	pos = kp_pos_of(kp_get(params->kp, kmerpair));
+	delta = 0;
+	for(c = 0; c < change_total; c += PRESENCE_WORD_BITS){
+	  len = (change_total - c < PRESENCE_WORD_BITS) ? 
+	    change_total - c : PRESENCE_WORD_BITS;
+	  pred = adaboost_pred_word_rows(params->presence,
+					 params->h_i, params->h_j, params->ybits,
+					 &pos, &((params->change_rows)[c]), len, &y);
+	  delta = adaboost_masked_sum(pred ^ y, &((params->change_w)[c]), delta);
+	}
+	(params->err)[kmerpair] += params->round[0].change_factor * delta;
+	adaboost_thread_best(&(params->best[0]), params->kp,
+			     (params->err)[kmerpair], kmerpair);
+      }
+    }
+  }  
+  return NULL;
+}
+
+/* step 3 (incremental mode) : count correctly predicted rows */
+void *adaboost_thread_count_changes(void *args){
+  adaboost_thread_args *params = (adaboost_thread_args *)args;
+  unsigned long x, x_end;
+  csr_cursor cur;
+
+  csr_cursor_reset(&cur);
+  x_end = params->block_end * ADABOOST_ROW_BLOCK;
+  if(x_end > params->N){
+    x_end = params->N;
+  }
+  params->change_num = 0;
+  for(x = params->block_begin * ADABOOST_ROW_BLOCK; 
+      x < x_end; x += PRESENCE_WORD_BITS){
+    params->change_num += 
+      __builtin_popcountll(adaboost_correct_word(params, 0, x, &cur));
+  }
+  return NULL;
+}
+
+/**
+ * step 3 (incremental mode) : record the rows to be changed
+ *  (correct or incorrect ones, whichever is fewer) with their old weights,
+ *  compute new weights and the partial sums of w for the next round
+ */
+void *adaboost_thread_update_incremental(void *args){
+  adaboost_thread_args *params = (adaboost_thread_args *)args;
+  const adaboost_round *round = &(params->round[0]);
+  const double factor = 1 + round->change_factor;
+  unsigned long x, x_end, c = params->change_begin;
+  uint64_t changed;
+  csr_cursor cur;
+
+  csr_cursor_reset(&cur);
+  x_end = params->block_end * ADABOOST_ROW_BLOCK;
+  if(x_end > params->N){
+    x_end = params->N;
+  }
+  for(x = params->block_begin * ADABOOST_ROW_BLOCK; 
+      x < x_end; x += PRESENCE_WORD_BITS){
+    changed = adaboost_correct_word(params, 0, x, &cur);
+    if(round->change_correct == 0){
+      changed = ~changed;
+      if(params->N - x < PRESENCE_WORD_BITS){
+	changed &= ((uint64_t)1 << (params->N - x)) - 1;
+      }
+    }
+    while(changed != 0){
+      (params->change_rows)[c] = x + __builtin_ctzll(changed);
+      (params->change_w)[c] = (params->w)[(params->change_rows)[c]];
+      (params->w)[(params->change_rows)[c]] *= factor;
+      c++;
+      changed &= changed - 1;
+    }
+  }
+
+  adaboost_thread_wsum(args);
+  return NULL;
+}
+
 int adaboost_set_y(hic *hic,
 		   const double threshold,
 		   unsigned int **y){
@@ -143,229 +1489,1040 @@ int adaboost_set_y(hic *hic,
   return 0;
 }
 
+/**
+ * merge the local argmin / argmax of the threads, and of the processes
+ * if group is not NULL (through the coordinator, see adaboost_learn)
+ */
+void adaboost_reduce_best(const adaboost_thread_args *params,
+			  const int thread_num,
+			  const unsigned int model_num,
+			  shard_group *group,
+			  adaboost_best *best){
+  unsigned int k;
+  int i;
+
+  for(k = 0; k < model_num; k++){
+    best[k].found = 0;
+    for(i = 0; i < thread_num; i++){
+      adaboost_merge_best(&(best[k]), params[0].kp, &(params[i].best[k]));
+    }
+  }
+  if(group != NULL){
+    adaboost_best *slot = (adaboost_best *)group->data;
+    memcpy(slot + group->rank * model_num, best, model_num * sizeof(adaboost_best));
+    shard_barrier(group);
+    if(group->rank == 0){
+      for(k = 0; k < model_num; k++){
+	best[k].found = 0;
+	for(i = 0; i < group->num; i++){
+	  adaboost_merge_best(&(best[k]), params[0].kp,
+			      &(slot[i * model_num + k]));
+	}
+      }
+      memcpy(slot + group->num * model_num, best,
+	     model_num * sizeof(adaboost_best));
+    }
+    shard_barrier(group);
+    memcpy(best, slot + group->num * model_num,
+	   model_num * sizeof(adaboost_best));
+  }
+}
+
+/**
+ * error of k-mer pair lm for model k on all rows
+ *  (the same sum as in adaboost_comp_err)
+ */
+double adaboost_pair_err(const adaboost_thread_args *params,
+			 const unsigned int k,
+			 const unsigned long lm){
+  const kp_pos pos = kp_pos_of(kp_get(params->kp, lm));
+  unsigned long x;
+  uint64_t pred;
+  double err = 0;
+
+  for(x = 0; x < params->N; x += PRESENCE_WORD_BITS){
+    pred = adaboost_pred_word_simd(params->presence, params->h_i, params->h_j,
+				   &pos, x, params->N);
+    err = adaboost_masked_sum(pred ^ (params->ybits)[k * params->nword +
+						      (x >> PRESENCE_WORD_SHIFT)],
+			      &((params->p)[k * params->N + x]), err);
+  }
+  return err;
+}
+
+/* kth smallest element (0-based) of a[0..n) (reorders a) */
+double adaboost_select_kth(double *a,
+			   const unsigned long n,
+			   const unsigned long kth){
+  long lo = 0, hi = (long)n - 1, i, j;
+  double pivot, tmp;
+
+  while(lo < hi){
+    pivot = a[lo + (hi - lo) / 2];
+    i = lo;
+    j = hi;
+    while(i <= j){
+      while(a[i] < pivot){
+	i++;
+      }
+      while(a[j] > pivot){
+	j--;
+      }
+      if(i <= j){
+	tmp = a[i];
+	a[i++] = a[j];
+	a[j--] = tmp;
+      }
+    }
+    /* [lo, j] <= pivot, [i, hi] >= pivot, and (j, i) == pivot */
+    if((long)kth <= j){
+      hi = j;
+    }else if((long)kth >= i){
+      lo = i;
+    }else{
+      break;
+    }
+  }
+  return a[kth];
+}
+
+/**
+ * sample the rows of round t: the ceil(top * N) rows with the largest
+ * p, and each of the others with probability rate (hashed from t and
+ * the row, so every process draws the same sample) and weight p / rate.
+ * The sampled weights are normalized to sum 1.
+ */
+void adaboost_goss_sample(adaboost_goss *goss,
+			  const double *p,
+			  const uint64_t *ybits,
+			  const unsigned int *h_i,
+			  const unsigned int *h_j,
+			  const unsigned long N,
+			  const unsigned long t){
+  const unsigned long top_num =
+    ((unsigned long)ceil(goss->top * N) < N) ? (unsigned long)ceil(goss->top * N) : N;
+  const uint64_t cut = (goss->rate >= 1) ? UINT64_MAX :
+    (uint64_t)(goss->rate * 18446744073709551616.0);
+  unsigned long x, n = 0, ties = 0;
+  double v = INFINITY, weight, sum = 0;
+
+  if(top_num > 0){
+    memcpy(goss->tmp, p, N * sizeof(double));
+    v = adaboost_select_kth(goss->tmp, N, N - top_num);
+    /* rows equal to v that are taken as top rows */
+    ties = top_num;
+    for(x = 0; x < N; x++){
+      ties -= (p[x] > v);
+    }
+  }
+
+  memset(goss->ybits, 0, ((N + PRESENCE_WORD_BITS - 1) / PRESENCE_WORD_BITS) *
+	 sizeof(uint64_t));
+  for(x = 0; x < N; x++){
+    if(p[x] > v){
+      weight = p[x];
+    }else if(p[x] == v && ties > 0){
+      weight = p[x];
+      ties--;
+    }else if(goss->rate >= 1 || threshold_hash(((uint64_t)t << 40) ^ x) < cut){
+      weight = p[x] / goss->rate;
+    }else{
+      continue;
+    }
+    goss->h_i[n] = h_i[x];
+    goss->h_j[n] = h_j[x];
+    goss->p[n] = weight;
+    if((ybits[x >> PRESENCE_WORD_SHIFT] >> (x & PRESENCE_WORD_MASK)) & 1){
+      goss->ybits[n >> PRESENCE_WORD_SHIFT] |=
+	(uint64_t)1 << (n & PRESENCE_WORD_MASK);
+    }
+    sum += weight;
+    n++;
+  }
+  for(x = 0; x < n; x++){
+    goss->p[x] /= sum;
+  }
+  goss->N = n;
+  goss->row_sum += n;
+}
+
+/**
+ * checkpoint of the training (--checkpoint, --resume)
+ *  header, thresholds[model_num], then for each model the stamps of
+ *  the T rounds done (axis[T], beta[T], sign[T]), the used k-mer pairs
+ *  (one bit per pair and model) and the weights w[model_num * N].
+ *  The weights are exactly those of the next round, so a resumed run
+ *  selects the same stamps as an uninterrupted one.
+ */
+
+#define ADABOOST_CHECKPOINT_MAGIC "CLCckpt"
+#define ADABOOST_CHECKPOINT_VERSION 2
+
+typedef struct _adaboost_checkpoint_header {
+  char magic[8];
+  uint32_t version;
+  uint32_t k;
+  uint32_t model_num;
+  uint32_t incremental;
+  uint64_t N;
+  uint64_t pair_num;
+  /* sampling of the rows (--goss, --gossAudit), 0 if exact */
+  double goss_top;
+  double goss_other;
+  uint64_t goss_audit;
+  /* rounds done */
+  uint64_t T;
+} adaboost_checkpoint_header;
+
+/* write to file.tmp and rename, so that file is always complete */
+int adaboost_checkpoint_write(const command_line_arguements *cmd_args,
+			      const char *file,
+			      const unsigned long T,
+			      const unsigned int model_num,
+			      const double *threshold,
+			      adaboost **model,
+			      const unsigned long pair_num,
+			      const uint64_t *marked,
+			      const unsigned long N,
+			      const double *w){
+  const unsigned long mword = adaboost_marked_words(pair_num);
+  adaboost_checkpoint_header header;
+  char tmp_file[F_NAME_LEN + 8];
+  unsigned int k;
+  FILE *fp;
+
+  memset(&header, 0, sizeof(adaboost_checkpoint_header));
+  memcpy(header.magic, ADABOOST_CHECKPOINT_MAGIC, sizeof(header.magic));
+  header.version = ADABOOST_CHECKPOINT_VERSION;
+  header.k = cmd_args->k;
+  header.model_num = model_num;
+  header.incremental = (cmd_args->exec_mode_incremental != 0);
+  header.N = N;
+  header.pair_num = pair_num;
+  header.goss_top = cmd_args->goss_top;
+  header.goss_other = cmd_args->goss_other;
+  header.goss_audit = cmd_args->goss_audit;
+  header.T = T;
+
+  sprintf(tmp_file, "%s.tmp", file);
+  if((fp = fopen(tmp_file, "wb")) == NULL){
+    fprintf(stderr, "error: fopen %s\n%s\n",
+	    tmp_file, strerror(errno));
+    exit(EXIT_FAILURE);
+  }
+  cache_fwrite(&header, sizeof(adaboost_checkpoint_header), 1, fp, tmp_file);
+  cache_fwrite(threshold, sizeof(double), model_num, fp, tmp_file);
+  for(k = 0; k < model_num; k++){
+    cache_fwrite(model[k]->axis, sizeof(unsigned long), T, fp, tmp_file);
+    cache_fwrite(model[k]->beta, sizeof(double), T, fp, tmp_file);
+    cache_fwrite(model[k]->sign, sizeof(unsigned int), T, fp, tmp_file);
+  }
+  cache_fwrite(marked, sizeof(uint64_t), model_num * mword, fp, tmp_file);
+  cache_fwrite(w, sizeof(double), model_num * N, fp, tmp_file);
+  if(fflush(fp) != 0 || fsync(fileno(fp)) != 0 || fclose(fp) != 0 ||
+     rename(tmp_file, file) != 0){
+    fprintf(stderr, "error: checkpoint %s\n%s\n",
+	    file, strerror(errno));
+    exit(EXIT_FAILURE);
+  }
+
+  fprintf(stderr, "%s: info: AdaBoost: checkpoint after %ld rounds written to %s\n",
+	  cmd_args->prog_name, T, file);
+  return 0;
+}
+
+/**
+ * restore the state after the rounds saved in file
+ *  returns the number of rounds done, or 0 (with a warning) if there
+ *  is no checkpoint; a checkpoint of other data is an error.
+ *  Stamps beyond T_max (the current --iteration_num) are not restored.
+ */
+unsigned long adaboost_checkpoint_read(const command_line_arguements *cmd_args,
+				       const char *file,
+				       const unsigned int model_num,
+				       const double *threshold,
+				       adaboost **model,
+				       const unsigned long pair_num,
+				       uint64_t *marked,
+				       const unsigned long N,
+				       double *w){
+  const unsigned long mword = adaboost_marked_words(pair_num);
+  adaboost_checkpoint_header header;
+  unsigned long T, T_max = cmd_args->iteration_num;
+  unsigned int k;
+  double *buf;
+  FILE *fp;
+
+  if((fp = fopen(file, "rb")) == NULL){
+    fprintf(stderr, "%s: warning: AdaBoost: no checkpoint %s, starting from scratch\n",
+	    cmd_args->prog_name, file);
+    return 0;
+  }
+  buf = calloc_errchk(model_num + 1, sizeof(double), "calloc: checkpoint buf");
+  if(fread(&header, sizeof(adaboost_checkpoint_header), 1, fp) != 1 ||
+     memcmp(header.magic, ADABOOST_CHECKPOINT_MAGIC, sizeof(header.magic)) != 0 ||
+     header.version != ADABOOST_CHECKPOINT_VERSION ||
+     header.k != cmd_args->k || header.model_num != model_num ||
+     header.incremental != (cmd_args->exec_mode_incremental != 0) ||
+     header.N != N || header.pair_num != pair_num ||
+     header.goss_top != cmd_args->goss_top ||
+     header.goss_other != cmd_args->goss_other ||
+     header.goss_audit != cmd_args->goss_audit ||
+     fread(buf, sizeof(double), model_num, fp) != model_num ||
+     memcmp(buf, threshold, model_num * sizeof(double)) != 0){
+    fprintf(stderr, "error: checkpoint %s does not match the current data and parameters\n",
+	    file);
+    exit(EXIT_FAILURE);
+  }
+  free(buf);
+
+  T = header.T;
+  buf = calloc_errchk(T + 1, sizeof(unsigned long) + sizeof(double) + sizeof(unsigned int),
+		      "calloc: checkpoint buf");
+  for(k = 0; k < model_num; k++){
+    if(fread(buf, sizeof(unsigned long) + sizeof(double) + sizeof(unsigned int),
+	     T, fp) != T){
+      fprintf(stderr, "error: checkpoint %s is truncated\n", file);
+      exit(EXIT_FAILURE);
+    }
+    memcpy(model[k]->axis, buf,
+	   ((T < T_max) ? T : T_max) * sizeof(unsigned long));
+    memcpy(model[k]->beta, (char *)buf + T * sizeof(unsigned long),
+	   ((T < T_max) ? T : T_max) * sizeof(double));
+    memcpy(model[k]->sign, (char *)buf + T * (sizeof(unsigned long) + sizeof(double)),
+	   ((T < T_max) ? T : T_max) * sizeof(unsigned int));
+  }
+  if(fread(marked, sizeof(uint64_t), model_num * mword, fp) != model_num * mword ||
+     fread(w, sizeof(double), model_num * N, fp) != model_num * N){
+    fprintf(stderr, "error: checkpoint %s is truncated\n", file);
+    exit(EXIT_FAILURE);
+  }
+  fclose(fp);
+  free(buf);
+
+  fprintf(stderr, "%s: info: AdaBoost: resuming after %ld rounds from %s\n",
+	  cmd_args->prog_name, T, file);
+  return T;
+}
+
+/**
+ * learn model_num models side by side, one per threshold
+ *  (model[k] is written to output_file[k]); the data and the
+ *  predictions of the weak learners are shared between the models.
+ *  The state is saved to checkpoint_file every --checkpoint rounds
+ *  and after the last one, and restored from it with --resume.
+ */
 int adaboost_learn(const command_line_arguements *cmd_args,
-		   const unsigned int **kmer_freq,
+		   thread_pool *pool,
+		   const kmer_presence *presence,
+		   const kmer_count *kc,
+		   const kmer_index *index,
 		   hic *hic,
-		   const double threshold,
+		   const unsigned int model_num,
+		   const double *threshold,
 		   const canonical_kp *kp,
 		   adaboost **model,
-		   const char *output_file){
+		   char **output_file,
+		   const char *checkpoint_file){
   const unsigned long canonical_kmer_pair_num = 
-    (1 << (4 * (cmd_args->k) - 1)) + (1 << (2 * (cmd_args->k) - 1));  
-  unsigned long n, lm, argmin_lm, argmax_lm;
-  unsigned int *marked, *y, pred;
-  double *err, *w, *p, wsum, epsilon, min, max;
+    (1UL << (4 * (cmd_args->k) - 1)) + (1UL << (2 * (cmd_args->k) - 1));  
+  const unsigned long nword = (hic->nrow + PRESENCE_WORD_BITS - 1) / PRESENCE_WORD_BITS;
+  const int sparse = (presence == NULL);
+  const int gemm = (cmd_args->exec_mode_gemm != 0);
+  unsigned long n, lm, argmin_lm, argmax_lm, t_begin = 0;
+  uint64_t *marked;
+  unsigned int *y, k;
+  uint64_t *ybits, *pred_bits = NULL;
+  double *err = NULL, *w, *p, *s = NULL, epsilon, min, max;
   char **kmer_strings;
   struct timeval t0, time;
 
+  if(model_num > 1 && cmd_args->exec_mode_incremental != 0){
+    show_error(stderr, cmd_args->prog_name,
+	       "AdaBoost: incremental mode learns a single model");
+    exit(EXIT_FAILURE);
+  }
+  if((cmd_args->goss_top > 0 || cmd_args->goss_other > 0) &&
+     (model_num > 1 || sparse || cmd_args->exec_mode_incremental != 0)){
+    show_error(stderr, cmd_args->prog_name,
+	       "AdaBoost: row sampling needs a single dense, non-incremental model");
+    exit(EXIT_FAILURE);
+  }
+  if(gemm && (sparse || hic->row_ptr == NULL ||
+	      cmd_args->exec_mode_incremental != 0)){
+    show_error(stderr, cmd_args->prog_name,
+	       "AdaBoost: the co-occurrence engine needs dense k-mer profiles, bin-blocked Hi-C data and a non-incremental model");
+    exit(EXIT_FAILURE);
+  }
+  if(cmd_args->exec_mode_prune != 0 && cmd_args->exec_mode_incremental != 0){
+    show_error(stderr, cmd_args->prog_name,
+	       "AdaBoost: pruning is not available in incremental mode");
+    exit(EXIT_FAILURE);
+  }
+
   /* allocate memory */
   {
-    *model = calloc_errchk(1, sizeof(adaboost), "calloc adaboost");
-    (*model)->axis = calloc_errchk(cmd_args->iteration_num, sizeof(unsigned long), "calloc adaboost -> axis");
-    (*model)->beta = calloc_errchk(cmd_args->iteration_num, sizeof(double), "calloc adaboost -> beta");
-    (*model)->sign = calloc_errchk(cmd_args->iteration_num, sizeof(unsigned int), "calloc adaboost -> sign");
-    (*model)->T = cmd_args->iteration_num;
-    marked = calloc_errchk(canonical_kmer_pair_num, sizeof(unsigned int), "calloc: marked");
-    err = calloc_errchk(canonical_kmer_pair_num, sizeof(double), "calloc: err");
-    w = calloc_errchk(hic->nrow, sizeof(double), "calloc: p");
-    p = calloc_errchk(hic->nrow, sizeof(double), "calloc: p");
-    for(n = 0; n < hic->nrow; n++){
+    for(k = 0; k < model_num; k++){
+      model[k] = calloc_errchk(1, sizeof(adaboost), "calloc adaboost");
+      model[k]->axis = calloc_errchk(cmd_args->iteration_num, sizeof(unsigned long), "calloc adaboost -> axis");
+      model[k]->beta = calloc_errchk(cmd_args->iteration_num, sizeof(double), "calloc adaboost -> beta");
+      model[k]->sign = calloc_errchk(cmd_args->iteration_num, sizeof(unsigned int), "calloc adaboost -> sign");
+      model[k]->T = cmd_args->iteration_num;
+    }
+    marked = calloc_errchk(model_num * adaboost_marked_words(canonical_kmer_pair_num) + 1,
+			   sizeof(uint64_t), "calloc: marked");
+    if(cmd_args->exec_mode_incremental != 0){
+      err = calloc_errchk(canonical_kmer_pair_num, sizeof(double), "calloc: err");
+    }
+    w = calloc_errchk(model_num * hic->nrow, sizeof(double), "calloc: p");
+    p = calloc_errchk(model_num * hic->nrow, sizeof(double), "calloc: p");
+    if(pool->node_of != NULL){
+      /* the row blocks of a worker are placed on its node */
+      numa_touch(pool, w, sizeof(double), hic->nrow, model_num, ADABOOST_ROW_BLOCK);
+      numa_touch(pool, p, sizeof(double), hic->nrow, model_num, ADABOOST_ROW_BLOCK);
+    }
+    for(n = 0; n < model_num * hic->nrow; n++){
       w[n] = 1.0 / (hic->nrow);
     }
-    adaboost_set_y(hic, threshold, &y);
+    ybits = calloc_errchk(model_num * nword + 1, sizeof(uint64_t), "calloc: ybits");
+    for(k = 0; k < model_num; k++){
+      uint64_t *bits;
+      adaboost_set_y(hic, threshold[k], &y);
+      presence_pack_bits(y, hic->nrow, &bits);
+      memcpy(ybits + k * nword, bits, nword * sizeof(uint64_t));
+      free(bits);
+      free(y);
+    }
+    if(sparse){
+      if(hic->row_ptr == NULL){
+	show_error(stderr, cmd_args->prog_name,
+		   "AdaBoost: sparse mode needs bin-blocked Hi-C data");
+	exit(EXIT_FAILURE);
+      }
+      pred_bits = calloc_errchk(model_num * nword + 1,
+				sizeof(uint64_t), "calloc: pred_bits");
+    }
+    if(sparse || gemm){
+      s = calloc_errchk(model_num * hic->nrow, sizeof(double), "calloc: s");
+      if(pool->node_of != NULL){
+	numa_touch(pool, s, sizeof(double), hic->nrow, model_num, ADABOOST_ROW_BLOCK);
+      }
+    }
     set_kmer_strings(cmd_args->k, &kmer_strings);
   }
 
   /* mark k-mer pairs containing forbidden k-mers */
   {
-    unsigned int mask, m;
+    unsigned long mask, l, c;
+    unsigned int m;
     unsigned int forbidden_kmer[1] = {141}; /* GATC */
     unsigned int forbidden_kmer_len[1] = {4};
     unsigned int forbidden_kmer_num = 1;
-    for(lm = 0; lm < canonical_kmer_pair_num; lm++){
-      for(m = 0; m < forbidden_kmer_num; m++){
-	if(marked[lm] != 0){
-	  break;
-	}else{
-	  mask = (1 << (2 * forbidden_kmer_len[m])) - 1;
-	  for(n = 0; 
-	      n < cmd_args->k - forbidden_kmer_len[m] + 1;
-	      n++){
-	    if(      (((kp->l1[lm]) >> (2 * n)) & mask) == forbidden_kmer[m]){
-	      marked[lm] = 1;
-	      break;
-	    }else if((((kp->m1[lm]) >> (2 * n)) & mask) == forbidden_kmer[m]){
-	      marked[lm] = 1;
-	      break;
-	    }else if((((kp->l2[lm]) >> (2 * n)) & mask) == forbidden_kmer[m]){
-	      marked[lm] = 1;
-	      break;
-	    }else if((((kp->m2[lm]) >> (2 * n)) & mask) == forbidden_kmer[m]){	
-	      marked[lm] = 1;
-	      break;
-	    }
+    unsigned char *forbidden;
+    /* k-mers containing a forbidden k-mer */
+    forbidden = calloc_errchk(kp->kmer_num, sizeof(unsigned char),
+			      "calloc: forbidden");
+    for(l = 0; l < kp->kmer_num; l++){
+      for(m = 0; m < forbidden_kmer_num && forbidden[l] == 0; m++){
+	mask = (1UL << (2 * forbidden_kmer_len[m])) - 1;
+	for(n = 0; 
+	    n + forbidden_kmer_len[m] <= cmd_args->k;
+	    n++){
+	  if(((l >> (2 * n)) & mask) == forbidden_kmer[m]){
+	    forbidden[l] = 1;
+	    break;
 	  }
 	}
       }
     }
+    /* pairs (l, c) in index order, see kmer.h */
+    lm = 0;
+    for(c = 0; c < kp->kmer_num; c++){
+      for(l = 0; l <= c; l++, lm++){
+	if(forbidden[l] | forbidden[c] |
+	   forbidden[kp_rev_comp(kp, l)] | forbidden[kp_rev_comp(kp, c)]){
+	  adaboost_mark(marked, canonical_kmer_pair_num, 0, lm);
+	}
+      }
+    }
+    for(k = 1; k < model_num; k++){
+      memcpy(marked + k * adaboost_marked_words(canonical_kmer_pair_num), marked,
+	     adaboost_marked_words(canonical_kmer_pair_num) * sizeof(uint64_t));
+    }
+    free(forbidden);
   }
 
   {
     n = 0;
     for(lm = 0; lm < canonical_kmer_pair_num; lm++){
-      if(marked[lm] != 0){
-	n++;
-      }
+      n += adaboost_marked_bit(marked, canonical_kmer_pair_num, 0, lm);
     }
     fprintf(stderr, "%s: info: AdaBoost: %ld out of %ld k-mer pairs are filtered out\n",
 	    cmd_args->prog_name, n, canonical_kmer_pair_num);
   }
 
+  if(cmd_args->exec_mode_resume != 0 && checkpoint_file != NULL){
+    t_begin = adaboost_checkpoint_read(cmd_args, checkpoint_file,
+				       model_num, threshold, model,
+				       canonical_kmer_pair_num, marked,
+				       hic->nrow, w);
+  }
 
-  if(cmd_args->exec_thread_num >= 1){
-    int i = 0;
-    unsigned long t;
-    adaboost_comp_err_args *params;
-    pthread_t *threads = NULL;
+
+  {
+    int i = 0, found, full_scan = 1, exact = 1;
+    unsigned long t, block_num, last_full_scan = 0, full_scan_num = 0;
+    unsigned long change_total = 0, correct_total, rows, next_pair, lm_s = 0;
+    unsigned int sign, sign_s = 0;
+    adaboost_thread_args *params, *sparams = NULL;
+    adaboost_round *round;
+    adaboost_best *best, *sbest = NULL, *prune = NULL;
+    adaboost_goss *goss = NULL;
+    double *wsum_block, *p1_block = NULL, *change_w = NULL;
+    double *marginal = NULL, *bin_p = NULL, *gemm_m = NULL, *gemm_d = NULL;
+    adaboost_best *gemm_range = NULL;
+    kmer_presence *presence_rc = NULL, *node_presence = NULL;
+    void **presence_copies = NULL, **h_i_copies = NULL, **h_j_copies = NULL;
+    unsigned long *change_rows = NULL;
+    shard_group *group = NULL;
+    int rank = 0;
+
+    /**
+     * --procs: the k-mer pairs are split among worker processes.
+     *  Each process keeps its own copy of the weights and applies the
+     *  same updates; only the local argmin / argmax of every process
+     *  go through the shared area (one slot per process and model),
+     *  and the coordinator publishes their merge (after the slots).
+     *  The errors of a pair do not depend on the split, so the stamps
+     *  are the same as with a single process.
+     *  The threads are split among the processes: every process runs
+     *  its share in a pool of its own (the threads of the caller's pool
+     *  are not inherited by the workers).
+     *  Known limit: only the pair search (step 2) is split. Every
+     *  process normalizes and updates the weights of all rows (steps 1
+     *  and 3) and, with --gemm, computes the whole products M and D,
+     *  so these parts do not get faster with more processes.
+     */
+    if(cmd_args->exec_proc_num > 1){
+      const int thread_num = pool->thread_num;
+      shard_create(cmd_args->exec_proc_num,
+		   (cmd_args->exec_proc_num + 1) * model_num * sizeof(adaboost_best),
+		   &group);
+      rank = shard_fork(group);
+      thread_pool_create(shard_thread_num(thread_num, group->num, rank), &pool);
+      if(cmd_args->exec_mode_numa != 0){
+	numa_pin_pool(pool, thread_num * rank / group->num, cmd_args->prog_name);
+      }
+    }
 
     /* prepare for thread programming */
     {
-      params = calloc_errchk(cmd_args->exec_thread_num,			   
-			     sizeof(adaboost_comp_err_args),
-			     "calloc: adaboost_comp_err_args");
-      threads = calloc_errchk(cmd_args->exec_thread_num,			   
-			      sizeof(pthread_t),
-			      "calloc: threads");        
+      block_num = (hic->nrow + ADABOOST_ROW_BLOCK - 1) / ADABOOST_ROW_BLOCK;
+      wsum_block = calloc_errchk(model_num * block_num + 1, sizeof(double),
+				 "calloc: wsum_block");
+      round = calloc_errchk(model_num, sizeof(adaboost_round),
+			    "calloc: adaboost_round");
+      best = calloc_errchk(model_num, sizeof(adaboost_best),
+			   "calloc: adaboost_best");
+      if(sparse || gemm){
+	p1_block = calloc_errchk(model_num * block_num + 1, sizeof(double),
+				 "calloc: p1_block");
+      }
+      if(sparse){
+	for(k = 0; k < model_num; k++){
+	  round[k].pred_bits = pred_bits + k * nword;
+	}
+      }
+      if(gemm){
+	unsigned int *rc = calloc_errchk(kp->kmer_num, sizeof(unsigned int),
+					 "calloc: rc");
+	for(n = 0; n < kp->kmer_num; n++){
+	  rc[n] = kp_rev_comp(kp, n);
+	}
+	set_kmer_presence_perm(presence, rc, &presence_rc);
+	free(rc);
+	gemm_m = calloc_errchk(model_num * kp->kmer_num * kp->kmer_num,
+			       sizeof(double), "calloc: gemm_m");
+	gemm_d = calloc_errchk(model_num * kp->kmer_num * kp->kmer_num,
+			       sizeof(double), "calloc: gemm_d");
+	gemm_range = calloc_errchk(model_num, sizeof(adaboost_best),
+				   "calloc: adaboost_best");
+      }
+      if(cmd_args->exec_mode_incremental != 0){
+	change_rows = calloc_errchk(hic->nrow, sizeof(unsigned long),
+				    "calloc: change_rows");
+	change_w = calloc_errchk(hic->nrow, sizeof(double),
+				 "calloc: change_w");
+	/**
+	 * err holds the unnormalized errors (w.r.t. w)
+	 * and w is normalized in place at every full scan
+	 */
+	p = w;
+      }
+      if(cmd_args->exec_mode_prune != 0){
+	marginal = calloc_errchk(model_num * 4 * kp->kmer_num, sizeof(double),
+				 "calloc: prune marginal");
+	bin_p = calloc_errchk(model_num * 4 * kc->bin_num + 1, sizeof(double),
+			      "calloc: prune bin_p");
+	prune = calloc_errchk(model_num, sizeof(adaboost_best),
+			      "calloc: adaboost_best");
+      }
+      if(pool->node_of != NULL){
+	/**
+	 * every worker scans all rows and the presence of all bins:
+	 *  one copy per node
+	 */
+	numa_replicate(pool, hic->i, hic->nrow * sizeof(unsigned int), &h_i_copies);
+	numa_replicate(pool, hic->j, hic->nrow * sizeof(unsigned int), &h_j_copies);
+	if(!sparse){
+	  numa_replicate(pool, presence->bits,
+			 presence->bin_num * presence->nword * sizeof(uint64_t),
+			 &presence_copies);
+	  node_presence = calloc_errchk(pool->node_num, sizeof(kmer_presence),
+					"calloc: node_presence");
+	  for(i = 0; i < pool->node_num; i++){
+	    node_presence[i] = *presence;
+	    node_presence[i].bits = presence_copies[i];
+	  }
+	}
+      }
+      params = calloc_errchk(pool->thread_num,
+			     sizeof(adaboost_thread_args),
+			     "calloc: adaboost_thread_args");
       /* set variables */
-      for(i = 0; i < cmd_args->exec_thread_num; i++){
+      for(i = 0; i < pool->thread_num; i++){
 	params[i].thread_id = i;
-	params[i].begin = ((i == 0) ? 0 : params[i - 1].end + 1);
-	params[i].end =
-	  ((i == (cmd_args->exec_thread_num - 1)) ?
-	   canonical_kmer_pair_num :
-	   ((canonical_kmer_pair_num / cmd_args->exec_thread_num) * (i + 1) - 1));
+	params[i].block_begin = block_num * i / pool->thread_num;
+	params[i].block_end = block_num * (i + 1) / pool->thread_num;
+	params[i].best = calloc_errchk(model_num, sizeof(adaboost_best),
+				       "calloc: adaboost_best");
+	params[i].acc = calloc_errchk(model_num, sizeof(double),
+				      "calloc: adaboost acc");
 	params[i].N = hic->nrow;
-	params[i].kmer_freq = kmer_freq;
+	params[i].pair_num = canonical_kmer_pair_num;
+	params[i].pair_begin = canonical_kmer_pair_num * rank /
+	  ((group != NULL) ? group->num : 1);
+	params[i].pair_end = canonical_kmer_pair_num * (rank + 1) /
+	  ((group != NULL) ? group->num : 1);
+	params[i].model_num = model_num;
+	params[i].block_num = block_num;
+	params[i].nword = nword;
+	params[i].next_pair = &next_pair;
+	params[i].round = round;
+	params[i].presence = presence;
+	params[i].kc = kc;
+	params[i].index = index;
+	params[i].hic_bin_num = hic->bin_num;
 	params[i].h_i = hic->i;
 	params[i].h_j = hic->j;
+	params[i].row_ptr = hic->row_ptr;
+	params[i].kp = kp;
 	params[i].marked = marked;
-	params[i].l1 = kp->l1;
-	params[i].m1 = kp->m1;
-	params[i].l2 = kp->l2;
-	params[i].m2 = kp->m2;
-	params[i].err = &err;
+	params[i].err = err;
+	params[i].w = w;
 	params[i].p = p;
-	params[i].y = y;
+	params[i].s = s;
+	params[i].ybits = ybits;
+	params[i].wsum_block = wsum_block;
+	params[i].p1_block = p1_block;
+	params[i].change_rows = change_rows;
+	params[i].change_w = change_w;
+	params[i].change_total = &change_total;
+	params[i].marginal = marginal;
+	params[i].bin_p = bin_p;
+	params[i].prune = prune;
+	params[i].prune_tol = 8.0 * hic->nrow * DBL_EPSILON;
+	/* whole bitmap words in dense mode */
+	params[i].kmer_begin = (((kp->kmer_num + PRESENCE_WORD_BITS - 1) >> PRESENCE_WORD_SHIFT) *
+				i / pool->thread_num) << PRESENCE_WORD_SHIFT;
+	params[i].kmer_end = (((kp->kmer_num + PRESENCE_WORD_BITS - 1) >> PRESENCE_WORD_SHIFT) *
+			      (i + 1) / pool->thread_num) << PRESENCE_WORD_SHIFT;
+	if(params[i].kmer_begin > kp->kmer_num){
+	  params[i].kmer_begin = kp->kmer_num;
+	}
+	if(params[i].kmer_end > kp->kmer_num){
+	  params[i].kmer_end = kp->kmer_num;
+	}
+	if(pool->node_of != NULL){
+	  params[i].h_i = h_i_copies[(pool->node_of)[i]];
+	  params[i].h_j = h_j_copies[(pool->node_of)[i]];
+	  if(!sparse){
+	    params[i].presence = &(node_presence[(pool->node_of)[i]]);
+	  }
+	}
+	params[i].gemm_m = gemm_m;
+	params[i].gemm_d = gemm_d;
+	params[i].presence_rc = presence_rc;
+	params[i].gemm_range = gemm_range;
+	params[i].col_begin = kp->kmer_num * i / pool->thread_num;
+	params[i].col_end = kp->kmer_num * (i + 1) / pool->thread_num;
+	if(gemm){
+	  params[i].gemm_row =
+	    calloc_errchk((model_num + 1) * (params[i].col_end - params[i].col_begin) + 1,
+			  sizeof(double), "calloc: gemm_row");
+	}
+      }
+      if(cmd_args->goss_top > 0 || cmd_args->goss_other > 0){
+	/* the sampled rows replace the data in a copy of the arguments */
+	goss = calloc_errchk(1, sizeof(adaboost_goss), "calloc: adaboost_goss");
+	goss->top = cmd_args->goss_top;
+	goss->rate = cmd_args->goss_other / (1 - cmd_args->goss_top);
+	goss->audit = ((cmd_args->goss_audit > 0) ?
+		       cmd_args->goss_audit : ADABOOST_GOSS_AUDIT);
+	goss->h_i = calloc_errchk(hic->nrow, sizeof(unsigned int), "calloc: goss h_i");
+	goss->h_j = calloc_errchk(hic->nrow, sizeof(unsigned int), "calloc: goss h_j");
+	goss->p = calloc_errchk(hic->nrow, sizeof(double), "calloc: goss p");
+	goss->tmp = calloc_errchk(hic->nrow, sizeof(double), "calloc: goss tmp");
+	goss->ybits = calloc_errchk(nword + 1, sizeof(uint64_t), "calloc: goss ybits");
+	sbest = calloc_errchk(model_num, sizeof(adaboost_best),
+			      "calloc: adaboost_best");
+	sparams = calloc_errchk(pool->thread_num,
+				sizeof(adaboost_thread_args),
+				"calloc: adaboost_thread_args");
+	for(i = 0; i < pool->thread_num; i++){
+	  sparams[i] = params[i];
+	  sparams[i].best = calloc_errchk(model_num, sizeof(adaboost_best),
+					  "calloc: adaboost_best");
+	  sparams[i].acc = calloc_errchk(model_num, sizeof(double),
+					 "calloc: adaboost acc");
+	  sparams[i].h_i = goss->h_i;
+	  sparams[i].h_j = goss->h_j;
+	  sparams[i].row_ptr = NULL;
+	  sparams[i].p = goss->p;
+	  sparams[i].ybits = goss->ybits;
+	  sparams[i].err = NULL;
+	  sparams[i].marginal = NULL;
+	}
       }
     }
 
     gettimeofday(&t0, NULL);
 
+    thread_pool_exec(pool, adaboost_thread_wsum,
+		     params, sizeof(adaboost_thread_args));
+
     /* AdaBoost iterations */
-    for(t = 0; t < cmd_args->iteration_num; t++){
+    for(t = t_begin; t < cmd_args->iteration_num; t++){
       /* step 1 : compute normalized weights p[] */
       {
-	wsum = 0;
-	for(n = 0; n < (hic->nrow); n++){
-	  wsum += w[n];
+	/* sum up block sums in a fixed order (independent of thread num) */
+	for(k = 0; k < model_num; k++){
+	  round[k].wsum = 0;
+	  for(n = 0; n < block_num; n++){
+	    round[k].wsum += wsum_block[k * block_num + n];
+	  }
+	}
+	if(cmd_args->exec_mode_incremental != 0){
+	  full_scan = (t == t_begin ||
+		       t - last_full_scan >= ADABOOST_INCREMENTAL_REFRESH ||
+		       change_total > hic->nrow / ADABOOST_INCREMENTAL_MAX_FRACTION);
 	}
-	for(n = 0; n < (hic->nrow); n++){
-	  p[n] = 1.0 * w[n] / wsum;
+	if(full_scan != 0){
+	  thread_pool_exec(pool, adaboost_thread_normalize,
+			   params, sizeof(adaboost_thread_args));
+	}
+	if(sparse || gemm){
+	  thread_pool_exec(pool, adaboost_thread_sparse_scores,
+			   params, sizeof(adaboost_thread_args));
+	  for(k = 0; k < model_num; k++){
+	    round[k].p1 = 0;
+	    for(n = 0; n < block_num; n++){
+	      round[k].p1 += p1_block[k * block_num + n];
+	    }
+	  }
+	}
+	if(full_scan != 0 && cmd_args->exec_mode_incremental != 0){
+	  /* w was normalized in place */
+	  thread_pool_exec(pool, adaboost_thread_wsum,
+			   params, sizeof(adaboost_thread_args));
+	  round[0].wsum = 0;
+	  for(n = 0; n < block_num; n++){
+	    round[0].wsum += wsum_block[n];
+	  }
+	  last_full_scan = t;
 	}
       }
 
       /* step 2 : find the most appropriate axis (weak lerner) */
       {
-	/* compute err for each kmer pair using pthread */
-	{
-	  /* pthread create */
-	  for(i = 0; i < cmd_args->exec_thread_num; i++){
-	    pthread_create(&threads[i], NULL, adaboost_comp_err, (void*)&params[i]);	
-	  }      
-	  /* pthread join */
-	  for(i = 0; i < cmd_args->exec_thread_num; i++){
-	    pthread_join(threads[i], NULL);
+	exact = (goss == NULL || t % goss->audit == 0);
+	if(goss != NULL){
+	  /* candidates on a row sample */
+	  adaboost_goss_sample(goss, p, ybits, hic->i, hic->j, hic->nrow, t);
+	  for(i = 0; i < pool->thread_num; i++){
+	    sparams[i].N = goss->N;
 	  }
+	  next_pair = params[0].pair_begin;
+	  thread_pool_exec(pool, adaboost_comp_err,
+			   sparams, sizeof(adaboost_thread_args));
+	  adaboost_reduce_best(sparams, pool->thread_num, model_num, group, sbest);
+	  goss->rounds++;
 	}
-
-	/* find best stamp */
-	{
-	  lm = 0;
-	  /* skip arleady selected kmer pairs */
-	  while(marked[lm] != 0){
-	    lm++;
+	if(exact && prune != NULL){
+	  /* bounds of the errors of the round (pairs of this process) */
+	  adaboost_prune_bins(&(params[0]), bin_p);
+	  thread_pool_exec(pool, adaboost_thread_prune_marginals,
+			   params, sizeof(adaboost_thread_args));
+	  next_pair = params[0].pair_begin;
+	  thread_pool_exec(pool, adaboost_thread_prune_bounds,
+			   params, sizeof(adaboost_thread_args));
+	  adaboost_reduce_best(params, pool->thread_num, model_num, NULL, prune);
+	}
+	if(exact){
+	  /* compute err and local argmin / argmax for each thread */
+	  next_pair = params[0].pair_begin;
+	  if(sparse){
+	    thread_pool_exec(pool, adaboost_comp_err_sparse,
+			     params, sizeof(adaboost_thread_args));
+	  }else if(gemm){
+	    /* all errors from the products, then exact re-scoring of the close ones */
+	    thread_pool_exec(pool, adaboost_thread_gemm,
+			     params, sizeof(adaboost_thread_args));
+	    thread_pool_exec(pool, adaboost_thread_gemm_range,
+			     params, sizeof(adaboost_thread_args));
+	    adaboost_reduce_best(params, pool->thread_num, model_num, NULL, gemm_range);
+	    next_pair = params[0].pair_begin;
+	    thread_pool_exec(pool, adaboost_thread_gemm_select,
+			     params, sizeof(adaboost_thread_args));
+	  }else if(full_scan != 0){
+	    thread_pool_exec(pool, adaboost_comp_err,
+			     params, sizeof(adaboost_thread_args));
+	    full_scan_num++;
+	  }else{
+	    thread_pool_exec(pool, adaboost_comp_err_incremental,
+			     params, sizeof(adaboost_thread_args));
 	  }
-	  /* find max and min*/
-	  max = min = err[lm];
-	  argmax_lm = argmin_lm = lm;
-	  for(lm++; lm < canonical_kmer_pair_num; lm++){
-	    if(marked[lm] == 0){
-	      if(err[lm] < min){
-		min = err[lm];
-		argmin_lm = lm;
-	      }else if(err[lm] > max){
-		max = err[lm];
-		argmax_lm = lm;
-	      }
+
+	  /* merge the local results of the threads (and of the processes) */
+	  adaboost_reduce_best(params, pool->thread_num, model_num, group, best);
+	}
+
+	/* find best stamp for each model */
+	for(k = 0; k < model_num; k++){
+	  if(goss != NULL){
+	    /* winner on the sample */
+	    if(sbest[k].found == 0){
+	      show_error(stderr, cmd_args->prog_name,
+			 "AdaBoost: no k-mer pair is left to be selected");
+	      exit(EXIT_FAILURE);
 	    }
+	    sign_s = (sbest[k].max + sbest[k].min > 1.0);
+	    lm_s = sign_s ? sbest[k].argmax_lm : sbest[k].argmin_lm;
 	  }
-	  /* compare max and min */
-	  {
-	    if(max + min > 1.0){
-	      /** 
-	       * min > 1 - max 
-	       *  argmaxd is the best axis
-	       */
-	      marked[argmax_lm]++;
-	      ((*model)->axis)[t] = argmax_lm;
-	      ((*model)->sign)[t] = 1;
-	      epsilon = 1 - max;
-	    }else{
-	      /*  argmind is the best axis */
-	      marked[argmin_lm]++;
-	      ((*model)->axis)[t] = argmin_lm;
-	      ((*model)->sign)[t] = 0;
-	      epsilon = min;       
-	    }      	    
+	  if(exact){
+	    found = best[k].found;
+	    min = best[k].min;
+	    max = best[k].max;
+	    argmin_lm = best[k].argmin_lm;
+	    argmax_lm = best[k].argmax_lm;
+	    if(found == 0){
+	      show_error(stderr, cmd_args->prog_name,
+			 "AdaBoost: no k-mer pair is left to be selected");
+	      exit(EXIT_FAILURE);
+	    }
+	    if(cmd_args->exec_mode_incremental != 0){
+	      min /= round[k].wsum;
+	      max /= round[k].wsum;
+	    }
+	    /* compare max and min */
+	    {
+	      if(max + min > 1.0){
+		/** 
+		 * min > 1 - max 
+		 *  argmaxd is the best axis
+		 */
+		lm = argmax_lm;
+		sign = 1;
+		epsilon = 1 - max;
+	      }else{
+		/*  argmind is the best axis */
+		lm = argmin_lm;
+		sign = 0;
+		epsilon = min;       
+	      }      	    
+	    }
+	    if(goss != NULL){
+	      goss->audits++;
+	      goss->misses += (lm != lm_s || sign != sign_s);
+	    }
+	  }else{
+	    /* re-score the winner of the sample on all rows */
+	    lm = lm_s;
+	    epsilon = adaboost_pair_err(&(params[0]), k, lm);
+	    sign = (epsilon > 0.5);
+	    if(sign){
+	      epsilon = 1 - epsilon;
+	    }
 	  }
+	  adaboost_mark(marked, canonical_kmer_pair_num, k, lm);
+	  (model[k]->axis)[t] = lm;
+	  (model[k]->sign)[t] = sign;
+	  (model[k]->beta)[t] = epsilon / (1 - epsilon);
 	}
       }
       /* step 3 : compute new weights */
       {
-	((*model)->beta)[t] = epsilon / (1 - epsilon);
-	for(n = 0; n < hic->nrow; n++){
-	  pred = 
-	    ((kmer_freq[hic->i[n]][kp->l1[((*model)->axis)[t]]] * 
-	      kmer_freq[hic->j[n]][kp->m1[((*model)->axis)[t]]] +
-	      kmer_freq[hic->i[n]][kp->l2[((*model)->axis)[t]]] * 
-	      kmer_freq[hic->j[n]][kp->m2[((*model)->axis)[t]]]) > 0) ? 1 : 0;
-	  if(((((*model)->sign)[t] == 0) && pred == y[n]) ||
-	     ((((*model)->sign)[t] == 1) && pred != y[n])){
-	    w[n] *= ((*model)->beta)[t];
+	for(k = 0; k < model_num; k++){
+	  round[k].pos = kp_pos_of(kp_get(kp, (model[k]->axis)[t]));
+	  round[k].sign = (model[k]->sign)[t];
+	  round[k].beta = (model[k]->beta)[t];
+	  if(sparse){
+	    memset(round[k].pred_bits, 0, nword * sizeof(uint64_t));
+	    adaboost_sparse_walk(&(params[0]), kp_get(kp, (model[k]->axis)[t]),
+				 NULL, round[k].pred_bits);
 	  }
 	}
+	if(cmd_args->exec_mode_incremental == 0){
+	  thread_pool_exec(pool, adaboost_thread_update,
+			   params, sizeof(adaboost_thread_args));
+	}else{
+	  thread_pool_exec(pool, adaboost_thread_count_changes,
+			   params, sizeof(adaboost_thread_args));
+	  correct_total = 0;
+	  for(i = 0; i < pool->thread_num; i++){
+	    correct_total += params[i].change_num;
+	  }
+	  /**
+	   * multiplying the weights of the correct rows by beta is the same
+	   * as multiplying the others by 1 / beta (up to normalization),
+	   * so we change whichever set is smaller
+	   */
+	  if(correct_total <= hic->nrow - correct_total || round[0].beta == 0){
+	    round[0].change_correct = 1;
+	    round[0].change_factor = round[0].beta - 1;
+	  }else{
+	    round[0].change_correct = 0;
+	    round[0].change_factor = 1 / round[0].beta - 1;
+	  }
+	  change_total = 0;
+	  for(i = 0; i < pool->thread_num; i++){
+	    if(round[0].change_correct == 0){
+	      rows = ((params[i].block_end * ADABOOST_ROW_BLOCK < hic->nrow) ?
+		      params[i].block_end * ADABOOST_ROW_BLOCK : hic->nrow);
+	      rows = ((params[i].block_begin * ADABOOST_ROW_BLOCK < rows) ?
+		      rows - params[i].block_begin * ADABOOST_ROW_BLOCK : 0);
+	      params[i].change_num = rows - params[i].change_num;
+	    }
+	    params[i].change_begin = change_total;
+	    change_total += params[i].change_num;
+	  }
+	  thread_pool_exec(pool, adaboost_thread_update_incremental,
+			   params, sizeof(adaboost_thread_args));
+	}
       }
       gettimeofday(&time, NULL);
-      adaboost_show_itr(stderr, 
-			*model, (const char**)kmer_strings, kp, 
-			t, diffSec(t0, time));
+      for(k = 0; k < model_num && rank == 0; k++){
+	adaboost_show_itr(stderr, 
+			  model[k], (const char**)kmer_strings, kp, 
+			  t, diffSec(t0, time));
+      }
+      if(rank == 0 && checkpoint_file != NULL && cmd_args->checkpoint_interval > 0 &&
+	 ((t + 1) % cmd_args->checkpoint_interval == 0 ||
+	  t + 1 == cmd_args->iteration_num)){
+	adaboost_checkpoint_write(cmd_args, checkpoint_file, t + 1,
+				  model_num, threshold, model,
+				  canonical_kmer_pair_num, marked,
+				  hic->nrow, w);
+      }
+    }
+    if(prune != NULL){
+      unsigned long checked = 0, skipped = 0;
+      for(i = 0; i < pool->thread_num; i++){
+	checked += params[i].prune_checked;
+	skipped += params[i].prune_skipped;
+      }
+      fprintf(stderr, "%s: info: AdaBoost: pruning%s: %ld out of %ld pair scans were skipped\n",
+	      cmd_args->prog_name, (group != NULL) ? " (this process)" : "",
+	      skipped, checked);
+      free(marginal);
+      free(bin_p);
+      free(prune);
+    }
+    if(gemm){
+      unsigned long rescored = 0;
+      for(i = 0; i < pool->thread_num; i++){
+	rescored += params[i].gemm_rescored;
+	free(params[i].gemm_row);
+      }
+      fprintf(stderr, "%s: info: AdaBoost: co-occurrence engine%s: %ld pairs were re-scored exactly\n",
+	      cmd_args->prog_name, (group != NULL) ? " (this process)" : "",
+	      rescored);
+      free(presence_rc->bits);
+      free(presence_rc);
+      free(gemm_m);
+      free(gemm_d);
+      free(gemm_range);
     }
+    if(h_i_copies != NULL){
+      numa_free_replicas(pool, h_i_copies);
+      numa_free_replicas(pool, h_j_copies);
+      if(presence_copies != NULL){
+	numa_free_replicas(pool, presence_copies);
+	free(node_presence);
+      }
+    }
+    if(group != NULL){
+      /* workers exit here */
+      shard_finish(group);
+    }
+    if(goss != NULL){
+      if(rank == 0){
+	fprintf(stderr, "%s: info: AdaBoost: row sampling: %.1f%% of the rows on average, the sampled winner differed from the exact one in %ld out of %ld audit rounds\n",
+		cmd_args->prog_name,
+		(goss->rounds > 0) ? 100.0 * goss->row_sum / goss->rounds / hic->nrow : 0.0,
+		goss->misses, goss->audits);
+      }
+      for(i = 0; i < pool->thread_num; i++){
+	free(sparams[i].best);
+	free(sparams[i].acc);
+      }
+      free(sparams);
+      free(sbest);
+      free(goss->h_i);
+      free(goss->h_j);
+      free(goss->p);
+      free(goss->tmp);
+      free(goss->ybits);
+      free(goss);
+    }
+    if(cmd_args->exec_mode_incremental != 0){
+      fprintf(stderr, "%s: info: AdaBoost: incremental mode: %ld out of %ld rounds were full scans\n",
+	      cmd_args->prog_name, full_scan_num, cmd_args->iteration_num);
+      free(change_rows);
+      free(change_w);
+    }
+    for(i = 0; i < pool->thread_num; i++){
+      free(params[i].best);
+      free(params[i].acc);
+    }
+    if(group != NULL){
+      /* the pool of the coordinator's share of the threads */
+      thread_pool_destroy(pool);
+    }
+    free(params);
+    free(round);
+    free(best);
+    free(wsum_block);
+    free(p1_block);
+    free(s);
+    free(pred_bits);
+    free(marked);
   }
   
   /* write to file OR stderr */
-  {
-    if(output_file == NULL){
-      adaboost_show_all(stderr, *model, (const char**)kmer_strings, kp);
+  for(k = 0; k < model_num; k++){
+    if(output_file == NULL || output_file[k] == NULL){
+      adaboost_show_all(stderr, model[k], (const char**)kmer_strings, kp);
     }else{
       FILE *fp;
-      if((fp = fopen(output_file, "w")) == NULL){
+      if((fp = fopen(output_file[k], "w")) == NULL){
 	fprintf(stderr, "error: fopen %s\n%s\n",
-		output_file, strerror(errno));
+		output_file[k], strerror(errno));
 	exit(EXIT_FAILURE);
       }
       fprintf(stderr, "%s: info: AdaBoost: writing results to file: %s\n",
-	      cmd_args->prog_name, output_file);
-      adaboost_show_all(fp, *model, (const char**)kmer_strings, kp);
+	      cmd_args->prog_name, output_file[k]);
+      adaboost_show_all(fp, model[k], (const char**)kmer_strings, kp);
       fclose(fp);
     }
   }
@@ -0,0 +1,356 @@
+#ifndef __CACHE_H__
+#define __CACHE_H__
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include "constant.h"
+#include "cmd_args.h"
+#include "calloc_errchk.h"
+#include "hic.h"
+#include "kmer_count.h"
+
+/**
+ * binary cache files for the preprocessed data
+ *  - k-mer count matrix (.freq)
+ *      header, validity bitmap, then the count arena (aligned to
+ *      KMER_COUNT_ALIGN), i.e. the layout of kmer_count
+ *  - normalized, size-selected and packed Hi-C contacts (.hic)
+ *      header, i[nrow], j[nrow], mij[nrow]
+ * The files are written to a temporary file that is renamed into
+ * place, so a file is never seen partially written or truncated.
+ * The header records the parameters the data depends on. With
+ * --skipPrep the files are memory-mapped (private, copy-on-write)
+ * instead of being recomputed; a missing or mismatching file falls
+ * back to the preprocessing.
+ */
+
+#define CACHE_MAGIC "CLCcache"
+#define CACHE_VERSION 3
+#define CACHE_KIND_KMER_FREQ 1
+#define CACHE_KIND_HIC 2
+#define CACHE_NAME_LEN 16
+
+typedef struct _cache_header {
+  char magic[8];
+  uint32_t version;
+  uint32_t kind;
+  uint32_t k;
+  uint32_t res;
+  int32_t chr;
+  uint32_t min_size;
+  uint32_t max_size;
+  /* bytes per k-mer count (.freq) */
+  uint32_t width;
+  char norm[CACHE_NAME_LEN];
+  char exp[CACHE_NAME_LEN];
+  /* number of bins (.freq) or rows (.hic) */
+  uint64_t num;
+  /* number of bins with a profile (.freq) */
+  uint64_t valid_num;
+} cache_header;
+
+/* sections start at 8-byte boundaries */
+static inline size_t cache_align(const size_t offset){
+  return (offset + 7) & ~((size_t)7);
+}
+
+void cache_set_header(const command_line_arguements *cmd_args,
+		      const uint32_t kind,
+		      cache_header *header){
+  memset(header, 0, sizeof(cache_header));
+  memcpy(header->magic, CACHE_MAGIC, sizeof(header->magic));
+  header->version = CACHE_VERSION;
+  header->kind = kind;
+  header->k = cmd_args->k;
+  header->res = cmd_args->res;
+  header->chr = cmd_args->chr;
+  header->min_size = cmd_args->min_size;
+  header->max_size = cmd_args->max_size;
+  header->width = kmer_count_width(cmd_args->count_width,
+				   cmd_args->res + cmd_args->k - 1);
+  if(cmd_args->norm != NULL){
+    strncpy(header->norm, cmd_args->norm, CACHE_NAME_LEN - 1);
+  }
+  if(cmd_args->exp != NULL){
+    strncpy(header->exp, cmd_args->exp, CACHE_NAME_LEN - 1);
+  }
+}
+
+/**
+ * check a header read from a file against the current parameters
+ * (the k-mer table depends on k, res, chr and the count width only)
+ */
+int cache_check_header(const command_line_arguements *cmd_args,
+		       const uint32_t kind,
+		       const cache_header *header){
+  cache_header expected;
+  cache_set_header(cmd_args, kind, &expected);
+
+  if(memcmp(header->magic, expected.magic, sizeof(header->magic)) != 0 ||
+     header->version != expected.version ||
+     header->kind != expected.kind){
+    return -1;
+  }
+  if(header->k != expected.k ||
+     header->res != expected.res ||
+     header->chr != expected.chr){
+    return -1;
+  }
+  if(kind == CACHE_KIND_KMER_FREQ && header->width != expected.width){
+    return -1;
+  }
+  if(kind == CACHE_KIND_HIC &&
+     (header->min_size != expected.min_size ||
+      header->max_size != expected.max_size ||
+      strncmp(header->norm, expected.norm, CACHE_NAME_LEN) != 0 ||
+      strncmp(header->exp, expected.exp, CACHE_NAME_LEN) != 0)){
+    return -1;
+  }
+  return 0;
+}
+
+void cache_fwrite(const void *ptr,
+		  const size_t size,
+		  const size_t num,
+		  FILE *fp,
+		  const char *file){
+  if(num > 0 && fwrite(ptr, size, num, fp) != num){
+    fprintf(stderr, "error: fwrite %s\n%s\n",
+	    file, strerror(errno));
+    exit(EXIT_FAILURE);
+  }
+}
+
+/**
+ * open a temporary file next to file for writing
+ *  the name has the pid in it, so that jobs that miss the same cache
+ *  at the same time do not write into each other's file
+ */
+FILE *cache_fopen_tmp(const char *file,
+		      char *tmp_file){
+  FILE *fp;
+  sprintf(tmp_file, "%s.%ld.tmp", file, (long)getpid());
+  if((fp = fopen(tmp_file, "wb")) == NULL){
+    fprintf(stderr, "error: fopen %s\n%s\n",
+	    tmp_file, strerror(errno));
+    exit(EXIT_FAILURE);
+  }
+  return fp;
+}
+
+/**
+ * flush the temporary file to disk and rename it to file
+ *  the rename replaces file atomically: readers (and mappings) of an
+ *  older file keep the old inode, and nobody sees a partial file
+ */
+void cache_fclose_rename(FILE *fp,
+			 const char *tmp_file,
+			 const char *file){
+  if(fflush(fp) != 0 || fsync(fileno(fp)) != 0 || fclose(fp) != 0 ||
+     rename(tmp_file, file) != 0){
+    fprintf(stderr, "error: cache %s\n%s\n",
+	    file, strerror(errno));
+    unlink(tmp_file);
+    exit(EXIT_FAILURE);
+  }
+}
+
+/* pad the file to the next 8-byte boundary */
+void cache_fpad(const size_t offset,
+		FILE *fp,
+		const char *file){
+  const char zero[8] = {0};
+  cache_fwrite(zero, 1, cache_align(offset) - offset, fp, file);
+}
+
+/**
+ * map a cache file and validate its header
+ *  returns -1 (with a warning) if the file cannot be used
+ */
+int cache_map(const command_line_arguements *cmd_args,
+	      const char *file,
+	      const uint32_t kind,
+	      void **map,
+	      size_t *map_len){
+  int fd;
+  struct stat stbuf;
+
+  if((fd = open(file, O_RDONLY)) == -1){
+    fprintf(stderr, "%s: warning: cache: cannot open %s (%s)\n",
+	    cmd_args->prog_name, file, strerror(errno));
+    return -1;
+  }
+  if(fstat(fd, &stbuf) == -1){
+    fprintf(stderr, "error: fstat %s\n%s\n",
+	    file, strerror(errno));
+    exit(EXIT_FAILURE);
+  }
+  if((size_t)stbuf.st_size < sizeof(cache_header)){
+    fprintf(stderr, "%s: warning: cache: %s is too short\n",
+	    cmd_args->prog_name, file);
+    close(fd);
+    return -1;
+  }
+
+  *map_len = stbuf.st_size;
+  if((*map = mmap(NULL, *map_len, PROT_READ | PROT_WRITE, MAP_PRIVATE,
+		  fd, 0)) == MAP_FAILED){
+    fprintf(stderr, "error: mmap %s\n%s\n",
+	    file, strerror(errno));
+    exit(EXIT_FAILURE);
+  }
+  close(fd);
+
+  if(cache_check_header(cmd_args, kind, (const cache_header *)*map) != 0){
+    fprintf(stderr, "%s: warning: cache: %s was made with different parameters\n",
+	    cmd_args->prog_name, file);
+    munmap(*map, *map_len);
+    return -1;
+  }
+  return 0;
+}
+
+int cache_write_kmer_freq(const command_line_arguements *cmd_args,
+			  const char *file,
+			  const kmer_count *kc){
+  const size_t valid_len = (kc->bin_num + 63) / 64 * sizeof(uint64_t);
+  const char zero[KMER_COUNT_ALIGN] = {0};
+  char tmp_file[F_NAME_LEN + 32];
+  cache_header header;
+  size_t offset;
+  unsigned long n;
+  FILE *fp;
+
+  cache_set_header(cmd_args, CACHE_KIND_KMER_FREQ, &header);
+  header.num = kc->bin_num;
+  for(n = 0; n < (kc->bin_num + 63) / 64; n++){
+    header.valid_num += __builtin_popcountll(kc->valid[n]);
+  }
+
+  fp = cache_fopen_tmp(file, tmp_file);
+  cache_fwrite(&header, sizeof(cache_header), 1, fp, tmp_file);
+  cache_fwrite(kc->valid, 1, valid_len, fp, tmp_file);
+  offset = sizeof(cache_header) + valid_len;
+  cache_fwrite(zero, 1, kmer_count_row_bytes(offset, 1) - offset, fp, tmp_file);
+  cache_fwrite(kc->counts, kc->row_bytes, kc->bin_num, fp, tmp_file);
+  cache_fclose_rename(fp, tmp_file, file);
+
+  fprintf(stderr, "%s: info: cache: k-mer frequency table written to %s\n",
+	  cmd_args->prog_name, file);
+  return 0;
+}
+
+int cache_load_kmer_freq(const command_line_arguements *cmd_args,
+			 const char *file,
+			 kmer_count **kc){
+  const cache_header *header;
+  const uint64_t *valid;
+  size_t map_len, offset, row_bytes;
+  unsigned long n, valid_num = 0;
+  void *map;
+
+  if(cache_map(cmd_args, file, CACHE_KIND_KMER_FREQ, &map, &map_len) != 0){
+    return -1;
+  }
+  header = (const cache_header *)map;
+  row_bytes = kmer_count_row_bytes(1UL << (2 * cmd_args->k), header->width);
+  offset = kmer_count_row_bytes(sizeof(cache_header) +
+				(header->num + 63) / 64 * sizeof(uint64_t), 1);
+  if(offset + header->num * row_bytes != map_len){
+    fprintf(stderr, "%s: warning: cache: %s is truncated\n",
+	    cmd_args->prog_name, file);
+    munmap(map, map_len);
+    return -1;
+  }
+  valid = (const uint64_t *)((char *)map + sizeof(cache_header));
+  for(n = 0; n < (header->num + 63) / 64; n++){
+    valid_num += __builtin_popcountll(valid[n]);
+  }
+  if(valid_num != header->valid_num){
+    fprintf(stderr, "%s: warning: cache: %s has an inconsistent validity bitmap\n",
+	    cmd_args->prog_name, file);
+    munmap(map, map_len);
+    return -1;
+  }
+
+  *kc = calloc_errchk(1, sizeof(kmer_count), "calloc: kmer_count");
+  (*kc)->bin_num = header->num;
+  (*kc)->kmer_num = 1UL << (2 * cmd_args->k);
+  (*kc)->width = header->width;
+  (*kc)->row_bytes = row_bytes;
+  (*kc)->valid = (uint64_t *)((char *)map + sizeof(cache_header));
+  (*kc)->counts = (unsigned char *)map + offset;
+  (*kc)->map = map;
+  (*kc)->map_len = map_len;
+
+  fprintf(stderr, "%s: info: cache: k-mer frequency table mapped from %s (%ld bins, %d-bit counts)\n",
+	  cmd_args->prog_name, file, (*kc)->bin_num, 8 * (*kc)->width);
+  return 0;
+}
+
+int cache_write_hic(const command_line_arguements *cmd_args,
+		    const char *file,
+		    const hic *data){
+  char tmp_file[F_NAME_LEN + 32];
+  cache_header header;
+  FILE *fp;
+
+  cache_set_header(cmd_args, CACHE_KIND_HIC, &header);
+  header.num = data->nrow;
+
+  fp = cache_fopen_tmp(file, tmp_file);
+  cache_fwrite(&header, sizeof(cache_header), 1, fp, tmp_file);
+  cache_fwrite(data->i, sizeof(unsigned int), data->nrow, fp, tmp_file);
+  cache_fwrite(data->j, sizeof(unsigned int), data->nrow, fp, tmp_file);
+  cache_fpad(2 * data->nrow * sizeof(unsigned int), fp, tmp_file);
+  cache_fwrite(data->mij, sizeof(double), data->nrow, fp, tmp_file);
+  cache_fclose_rename(fp, tmp_file, file);
+
+  fprintf(stderr, "%s: info: cache: Hi-C data written to %s\n",
+	  cmd_args->prog_name, file);
+  return 0;
+}
+
+int cache_load_hic(const command_line_arguements *cmd_args,
+		   const char *file,
+		   hic **data){
+  const cache_header *header;
+  size_t map_len, offset;
+  void *map;
+
+  if(cache_map(cmd_args, file, CACHE_KIND_HIC, &map, &map_len) != 0){
+    return -1;
+  }
+  header = (const cache_header *)map;
+  offset = cache_align(sizeof(cache_header) +
+		       2 * header->num * sizeof(unsigned int));
+  if(offset + header->num * sizeof(double) != map_len){
+    fprintf(stderr, "%s: warning: cache: %s is truncated\n",
+	    cmd_args->prog_name, file);
+    munmap(map, map_len);
+    return -1;
+  }
+
+  *data = calloc_errchk(1, sizeof(hic), "calloc hic");
+  (*data)->nrow = header->num;
+  (*data)->res = cmd_args->res;
+  (*data)->i = (unsigned int *)((char *)map + sizeof(cache_header));
+  (*data)->j = (*data)->i + (*data)->nrow;
+  (*data)->mij = (double *)((char *)map + offset);
+  (*data)->map = map;
+  (*data)->map_len = map_len;
+
+  fprintf(stderr, "%s: info: cache: Hi-C data mapped from %s (%ld rows)\n",
+	  cmd_args->prog_name, file, (*data)->nrow);
+  return 0;
+}
+
+#endif
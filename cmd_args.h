@@ -5,27 +5,66 @@
 typedef struct _command_line_arguements {
   /* parameters */
   int chr;
+  /* genome mode: --chrList c1,c2,... (chr_num is 0 for a single --chr) */
+  unsigned int chr_num;
+  char **chr_names;
+  /* memory budget of the concurrent per-chromosome jobs in MB (0: unlimited) */
+  unsigned long mem_budget;
   unsigned int k;
   unsigned int res;
   unsigned int min_size;
   unsigned int max_size;
   unsigned long iteration_num;
   double percentile;
+  /* --percentile p1,p2,...: models learned side by side */
+  unsigned int percentile_num;
+  double *percentiles;
   char *norm;
   char *exp;
+  /* bits per k-mer count (8, 16, 32; 0: smallest exact) */
+  unsigned int count_width;
+  /* rank error of sampled quantiles (0: exact) */
+  double quantile_eps;
+  /**
+   * --goss top,other: weak learners are searched on the top fraction of
+   * the rows by weight plus a sample of other x N rows (0, 0: all rows),
+   * with an exact search every goss_audit rounds
+   */
+  double goss_top;
+  double goss_other;
+  unsigned long goss_audit;
   /* input */
   char *fasta_file;
   char *hicRaw_dir;
   char *kmerFreq_file;
   char *hic_file;
   char *boost_oracle_file;
+  char *qp_warm_start_file;
   /* output */
   char *output_dir;
   /* exec_mode */
   int exec_mode_quite;
   int exec_mode_skip_prep;
   int exec_mode_QP_only;
+  /* write P and q of the QP as text files (not needed by the solver) */
+  int exec_mode_qp_dump;
+  int exec_mode_incremental;
+  int exec_mode_block_hic;
+  int exec_mode_sparse;
+  /* skip k-mer pairs whose error bounds cannot beat the best (exact) */
+  int exec_mode_prune;
+  /* errors of all pairs from k-mer co-occurrence products */
+  int exec_mode_gemm;
   int exec_thread_num;
+  /* pin the workers and place / replicate the data per NUMA node */
+  int exec_mode_numa;
+  /* vector kernels: scalar, sse4.2, avx2, avx512 (NULL or auto: detect) */
+  char *simd;
+  /* worker processes of AdaBoost (k-mer pairs are split among them) */
+  int exec_proc_num;
+  /* save the AdaBoost state every checkpoint_interval rounds (0: never) */
+  unsigned long checkpoint_interval;
+  int exec_mode_resume;
   char *prog_name;
 } command_line_arguements;
 
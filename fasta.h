@@ -1,11 +1,20 @@
 #ifndef __FASTA_H__
 #define __FASTA_H__
 
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <string.h>
+#include <errno.h>
 #include "constant.h"
 #include "cmd_args.h"
 #include "mywc.h"
 #include "calloc_errchk.h"
 #include "diffSec.h"
+#include "thread_pool.h"
+#include "kmer_count.h"
 
 /**
  * This header file contains some functions to perform the following tasks
@@ -14,277 +23,427 @@
  */
 
 
-/* arguements for function */
+/* number of bins a counting thread takes at a time */
+#define KMER_FREQ_BIN_CHUNK 64
+
+/* arguements for function kmer_freq_count */
 typedef struct _kmer_freq_count_args{
   int thread_id;
-  unsigned long begin;
-  unsigned long end;
+  unsigned long *next_bin;
+  unsigned long bin_num;
   unsigned int k;
   unsigned int res;
-  char *seq;
-  unsigned int ***kmer_freq;
+  const char *seq;
+  unsigned long seq_len;
+  const unsigned char *nt_code;
+  kmer_count *kc;
+  /* bin b of the sequence is row bin_offset + b of kc */
+  unsigned long bin_offset;
+  /* sparse profiles: (k-mer, count) entries of the bins of this thread */
+  int sparse;
+  kmer_sparse_buf buf;
+  /* per bin: thread id + 1 of the owner (0: no profile), offset in its buf */
+  int *owner;
+  unsigned long *offset;
+  /* number of bins skipped by this thread */
+  unsigned long skipped;
+  /* number of counts clipped to the count width */
+  unsigned long saturated;
 } kmer_freq_count_args;
 
 
-/* read fasta file */
+/**
+ * FASTA sequence
+ *  The file is memory-mapped. If the sequence is on a single line,
+ *  seq is a view into the mapping; otherwise the lines are joined
+ *  into buf and seq points there. seq is not NUL-terminated.
+ */
+typedef struct _fasta {
+  /* first word of the header line */
+  char *head;
+  const char *seq;
+  unsigned long seq_len;
+  void *map;
+  size_t map_len;
+  char *buf;
+} fasta;
+
+/**
+ * set the sequence of fa from the record body [p, stop)
+ *  (a view if it is on a single line, joined into fa->buf otherwise)
+ */
+int fasta_set_seq(fasta *fa,
+		  const char *p,
+		  const char *stop){
+  const char *eol, *rest;
+  unsigned long len;
+
+  if((eol = memchr(p, '\n', stop - p)) == NULL){
+    eol = stop;
+  }
+  for(rest = eol; rest < stop && (*rest == '\n' || *rest == '\r'); rest++);
+  len = eol - p;
+  if(len > 0 && p[len - 1] == '\r'){
+    len--;
+  }
+
+  if(rest == stop){
+    /* single line: zero-copy view */
+    fa->seq = p;
+    fa->seq_len = len;
+  }else{
+    /* join the lines */
+    unsigned long n = 0;
+    fa->buf = calloc_errchk(stop - p, sizeof(char), "seq");
+    while(p < stop){
+      if((eol = memchr(p, '\n', stop - p)) == NULL){
+	eol = stop;
+      }
+      len = eol - p;
+      if(len > 0 && p[len - 1] == '\r'){
+	len--;
+      }
+      memcpy(fa->buf + n, p, len);
+      n += len;
+      p = eol + 1;
+    }
+    fa->seq = fa->buf;
+    fa->seq_len = n;
+  }
+  return 0;
+}
+
+/* read the first record of a fasta file */
 int fasta_read(const char *fasta_file, 
-	       char **seq_head,
-	       char **seq,
-	       unsigned long *seq_len){
+	       fasta **fa){
+  const char *p, *end, *eol, *stop;
+  int fd;
+  struct stat stbuf;
 
-  *seq_len = mywc_b(fasta_file);
-  {
-    FILE *fp;
-    char buf[BUF_SIZE];
+  *fa = calloc_errchk(1, sizeof(fasta), "calloc: fasta");
+  (*fa)->head = calloc_errchk(FASTA_HEADER_LEN, sizeof(char), "seq_head");
 
-    /* file open */
-    if((fp = fopen(fasta_file, "r")) == NULL){
-      fprintf(stderr, "error: fdopen %s\n%s\n",
+  /* map the file */
+  {
+    if((fd = open(fasta_file, O_RDONLY)) == -1){
+      fprintf(stderr, "error: open %s\n%s\n",
 	      fasta_file, strerror(errno));
       exit(EXIT_FAILURE);
     }
-
-    /* get sequence header */
-    {
-      *seq_head = calloc_errchk(FASTA_HEADER_LEN, sizeof(char), "seq_head");
-      fscanf(fp, "%s", *seq_head);
-
+    if(fstat(fd, &stbuf) == -1){
+      fprintf(stderr, "error: fstat %s\n%s\n",
+	      fasta_file, strerror(errno));
+      exit(EXIT_FAILURE);
+    }
+    if(stbuf.st_size == 0){
+      fprintf(stderr, "error: %s is empty\n", fasta_file);
+      exit(EXIT_FAILURE);
+    }
+    (*fa)->map_len = stbuf.st_size;
+    if(((*fa)->map = mmap(NULL, (*fa)->map_len, PROT_READ, MAP_PRIVATE,
+			  fd, 0)) == MAP_FAILED){
+      fprintf(stderr, "error: mmap %s\n%s\n",
+	      fasta_file, strerror(errno));
+      exit(EXIT_FAILURE);
+    }
+    madvise((*fa)->map, (*fa)->map_len, MADV_SEQUENTIAL);
+    close(fd);
+  }
+  p = (const char *)(*fa)->map;
+  end = p + (*fa)->map_len;
+
+  /* get sequence header */
+  if(*p == '>'){
+    unsigned long len = 0;
+    if((eol = memchr(p, '\n', end - p)) == NULL){
+      eol = end;
+    }
+    while(p + len < eol && len < FASTA_HEADER_LEN - 1 &&
+	  p[len] != ' ' && p[len] != '\t' && p[len] != '\r'){
+      len++;
     }
+    memcpy((*fa)->head, p, len);
+    p = (eol < end) ? eol + 1 : end;
+  }
 
-    /* get sequence body */ 
-    {
-      unsigned long i = 0;
-      *seq = calloc_errchk(*seq_len, sizeof(char), "seq");
-      while(fscanf(fp, "%s", buf) != EOF && i < *seq_len){	
-	strncpy(&((*seq)[i]), buf, strlen(buf));
-	i += strlen(buf);
-      }
-      *seq_len = i;
-      (*seq)[i++] = '\0';
-      if((*seq = realloc(*seq, i * sizeof(char))) == NULL){
-	fprintf(stderr, "realloc: seq\n");
-	exit(EXIT_FAILURE);
-      }
-    }    
-    fclose(fp);
+  /* the sequence ends at the next record (if any) */
+  if((stop = memchr(p, '>', end - p)) == NULL){
+    stop = end;
+  }else{
+    fprintf(stderr, "warning: %s: only the first record is used\n",
+	    fasta_file);
   }
 
+  fasta_set_seq(*fa, p, stop);
+
   return 0;
 }
 
-/* functionn to convert nucleotide letter to binary coded number */
-inline int c2i(const char c){
-  switch(c){
-    case 'A':
-    case 'a':
-      return 0;
-    case 'C':
-    case 'c':
-      return 1;
-    case 'G':
-    case 'g':
-      return 2;
-    case 'T':
-    case 't':
-      return 3;
-   default:
-     fprintf(stderr, "input genomic sequence contains unknown char : %c\n", c);
-     exit(EXIT_FAILURE);
+int fasta_free(fasta *fa){
+  if(fa->map != NULL){
+    munmap(fa->map, fa->map_len);
   }
+  free(fa->buf);
+  free(fa->head);
+  free(fa);
+  return 0;
 }
 
-#if 1
-int set_kmer_freq(const command_line_arguements *cmd_args,
-		  unsigned int ***kmer_freq){
-  const unsigned int bit_mask = (1 << (2 * (cmd_args->k))) - 1;
-  char *seq_head, *seq;
-  unsigned long seq_len, bin_num, bin;
-  unsigned int i, contain_n, kmer;
-
-  /* read fasta file */
-  fasta_read(cmd_args->fasta_file, 
-	     &seq_head, &seq, &seq_len);
-
-  bin_num = (seq_len / cmd_args->res);
-
-  fprintf(stderr, "%s: info: sequence: %s (%ld : %ld)\n", 
-	  cmd_args->prog_name, seq_head, seq_len, bin_num);
-
+/**
+ * 2-bit codes of nucleotide letters (A: 0, C: 1, G: 2, T: 3)
+ *  N is coded as NT_CODE_N (bins containing it are skipped),
+ *  any other letter as NT_CODE_UNKNOWN
+ */
+#define NT_CODE_N 4
+#define NT_CODE_UNKNOWN 5
 
-  /* allocate memory for k-mer frequency table */  
-  *kmer_freq = calloc_errchk(bin_num, sizeof(unsigned int *),
-			     "kmer_freq");			      
-  
-  /* count k-mer frequency */
-  for(bin = 0; bin < bin_num; bin++){
-    contain_n = 0;
-    for(i = bin * cmd_args->res; 
-	i < (bin + 1) * cmd_args->res + cmd_args->k - 1; i++){
-      if(seq[i] == 'N' || seq[i] == 'n'){	
-	contain_n = 1;
-	break;
-      }
-    }
-    if(contain_n != 0){
-      (*kmer_freq)[bin] = NULL;
-    }else{
-
-      /* For bins not containing 'N', allocate memory */
-      (*kmer_freq)[bin] = calloc_errchk((1 << (2 * (cmd_args->k))),
-					sizeof(unsigned int),
-					"calloc kmer_freq[]");
-      kmer = 0;
-      /* convert first (k-1)-mer to bit-encoded sequence */
-      for(i = bin * cmd_args->res;
-	  i < bin * cmd_args->res + cmd_args->k - 1; i++){
-	kmer <<= 2;
-	kmer += (c2i(seq[i]) & 3);
-      }
-      /* count k-mer frequency */
-      for(i = bin * cmd_args->res;
-	  i < (bin + 1) * cmd_args->res + cmd_args->k - 1; i++){
-	kmer <<= 2;
-	kmer += (c2i(seq[i]) & 3);
-	(*kmer_freq)[bin][(kmer & bit_mask)] += 1;
-      }
-    }    
+void set_nt_code(unsigned char *nt_code){
+  int c;
+  for(c = 0; c < 256; c++){
+    nt_code[c] = NT_CODE_UNKNOWN;
   }
+  nt_code['A'] = nt_code['a'] = 0;
+  nt_code['C'] = nt_code['c'] = 1;
+  nt_code['G'] = nt_code['g'] = 2;
+  nt_code['T'] = nt_code['t'] = 3;
+  nt_code['N'] = nt_code['n'] = NT_CODE_N;
+}
 
-  return 0;
+int uint32_comp(const void *cmp1,
+		const void *cmp2){
+  uint32_t u1 = *((const uint32_t *)cmp1);
+  uint32_t u2 = *((const uint32_t *)cmp2);
+  return (u1 > u2) - (u1 < u2);
 }
-#endif
 
-#if 0
+/**
+ * count k-mers in bins taken from a shared counter
+ *  a bin covers the k-mers ending in [bin * res, (bin + 1) * res + k - 1),
+ *  the window is primed with the first k - 1 bases of the bin.
+ *  The N check is done in the same pass: the bin is left invalid as
+ *  soon as an N (or the end of the sequence) is reached. Counts go to
+ *  a 32-bit scratch row first and are then stored at the table's width.
+ *  The k-mers seen in the bin are listed, so that only those entries
+ *  of the scratch row are cleared; in sparse mode the list is sorted
+ *  and the nonzero counts are appended to the thread's buffer.
+ */
 void *kmer_freq_count(void *args){
   kmer_freq_count_args *params = (kmer_freq_count_args *)args;
-  unsigned int bin = 0, i = 0, kmer = 0, contain_n = 0;
-  const unsigned int bit_mask = (1 << (2 * (params->k))) - 1;
-
-#if 1
-  fprintf(stderr, "thread %d: start [%ld : %ld]\n",
-	  params->thread_id, params->begin, params->end);  
-#endif
-
-  for(bin = params->begin; bin <= params->end; bin++){
-    contain_n = 0;
-
-    /* check if this genome bin contains 'N' and allocate memory */
-    for(i = bin * params->res;
-	i < (bin + 1) * params->res + params->k - 1; i++){
-      if((params->seq)[i] == 'N' || (params->seq)[i] == 'n'){	
-	contain_n = 1;
-	break;
+  const unsigned long bit_mask = (1UL << (2 * (params->k))) - 1;
+  const unsigned char *seq = (const unsigned char *)params->seq;
+  unsigned long bin, begin, end, chunk, i, kmer;
+  unsigned int *row;
+  uint32_t *touched;
+  unsigned long touched_num, t;
+  unsigned char code;
+
+  row = calloc_errchk(bit_mask + 1, sizeof(unsigned int),
+		      "calloc: kmer_freq_count row");
+  touched = calloc_errchk(params->res + params->k, sizeof(uint32_t),
+			  "calloc: kmer_freq_count touched");
+  params->skipped = 0;
+  params->saturated = 0;
+  while((chunk = __sync_fetch_and_add(params->next_bin, KMER_FREQ_BIN_CHUNK))
+	< params->bin_num){
+    for(bin = chunk;
+	bin < chunk + KMER_FREQ_BIN_CHUNK && bin < params->bin_num; bin++){
+      begin = bin * params->res;
+      end = (bin + 1) * params->res + params->k - 1;
+
+      if(end > params->seq_len){
+	params->skipped++;
+      }else{
+	kmer = 0;
+	touched_num = 0;
+	for(i = begin; i < begin + params->k - 1; i++){
+	  kmer = (kmer << 2) + (params->nt_code)[seq[i]];
+	}
+	for(i = begin; i < end; i++){
+	  if((code = (params->nt_code)[seq[i]]) > 3){
+	    if(code == NT_CODE_UNKNOWN){
+	      /* a bin with N is skipped even if other letters come first */
+	      for(t = i + 1; t < end && (params->nt_code)[seq[t]] != NT_CODE_N; t++);
+	      if(t == end){
+		fprintf(stderr, "input genomic sequence contains unknown char : %c\n",
+			seq[i]);
+		exit(EXIT_FAILURE);
+	      }
+	    }
+	    break;
+	  }
+	  kmer = (kmer << 2) + code;
+	  if(row[kmer & bit_mask]++ == 0){
+	    touched[touched_num++] = kmer & bit_mask;
+	  }
+	}
+	if(i == end && params->sparse){
+	  qsort(touched, touched_num, sizeof(uint32_t), uint32_comp);
+	  (params->owner)[bin] = params->thread_id + 1;
+	  (params->offset)[bin] = params->buf.num;
+	  params->kc->ptr[bin + 1] = touched_num;
+	  for(t = 0; t < touched_num; t++){
+	    kmer_sparse_buf_push(&(params->buf), touched[t], row[touched[t]]);
+	    row[touched[t]] = 0;
+	  }
+	  kmer_count_set_valid(params->kc, bin);
+	}else if(i == end){
+	  params->saturated += kmer_count_store(params->kc,
+						params->bin_offset + bin, row,
+						touched, touched_num);
+	}else{
+	  for(t = 0; t < touched_num; t++){
+	    row[touched[t]] = 0;
+	  }
+	  params->skipped++;
+	}
       }
     }
-  
-    if(contain_n != 0){
-
-      /* if the bin contains 'N', then skip */
-      (*(params->kmer_freq))[bin] = NULL;
-
-    }else{
-
-      /* For bins not containing 'N', allocate memory */
-      (*(params->kmer_freq))[bin] = calloc_errchk((1 << (2 * (params->k))),
-						  sizeof(unsigned int),
-						  "calloc kmer_freq[]");
-      kmer = 0;
-      /* convert first (k-1)-mer to bit-encoded sequence */
-      for(i = bin * params->res; 
-	  i < bin * params->res + params->k - 1; i++){
-	kmer <<= 2;
-	kmer += c2i((params->seq)[i]);
-      }
-      /* count k-mer frequency */
-      for(i = bin * params->res;
-	  i < (bin + 1) * params->res + params->k - 1; i++){
-	kmer <<= 2;
-	kmer += c2i((params->seq)[i]);
-	(*(params->kmer_freq))[bin][(kmer & bit_mask)] += 1;
+  }
+  free(row);
+  free(touched);
+  return NULL;
+}
+
+/**
+ * copy the sparse profiles of the bins counted by this thread
+ * to their place in the table
+ */
+void *kmer_freq_merge_sparse(void *args){
+  kmer_freq_count_args *params = (kmer_freq_count_args *)args;
+  kmer_count *kc = params->kc;
+  unsigned long bin, e;
+
+  params->saturated = 0;
+  for(bin = 0; bin < params->bin_num; bin++){
+    if((params->owner)[bin] == params->thread_id + 1){
+      for(e = 0; e < kc->ptr[bin + 1] - kc->ptr[bin]; e++){
+	params->saturated +=
+	  kmer_count_set_sparse(kc, kc->ptr[bin] + e,
+				params->buf.ids[(params->offset)[bin] + e],
+				params->buf.counts[(params->offset)[bin] + e]);
       }
     }
   }
+  free(params->buf.ids);
+  free(params->buf.counts);
   return NULL;
 }
 
-int set_kmer_freq_pthread(const command_line_arguements *cmd_args,
-		  unsigned int ***kmer_freq){
-  char *seq_head, *seq;
-  unsigned long seq_len, bin_num;
- 
-  /* read fasta file */
-  fasta_read(cmd_args->fasta_file, 
-	     &seq_head, &seq, &seq_len);
-  fprintf(stderr, "%s: info: sequence: %s (%ld)\n", 
-	  cmd_args->prog_name, seq_head, seq_len);
-  
-  /* count k-mer frequency */
-  {
-    kmer_freq_count_args *params;
-    pthread_t *threads = NULL;
-    int i;
-    bin_num = (seq_len / cmd_args->res); 
-
-    /* allocate memory for k-mer frequency table */  
-    *kmer_freq = calloc_errchk(bin_num, sizeof(unsigned int *),
-			       "kmer_freq");			      
-
-    /* allocate memory for threads */
-    params = calloc_errchk(cmd_args->exec_thread_num,			   
-			   sizeof(kmer_freq_count_args),
-			   "calloc: hic_prep_thread_args");
-    threads = calloc_errchk(cmd_args->exec_thread_num,			   
-			    sizeof(pthread_t),
-			    "calloc: threads");
-    /* set variables */
-    for(i = 0; i < cmd_args->exec_thread_num; i++){
-      params[i].thread_id = i;
-      params[i].begin = ((i == 0) ? 0 : params[i - 1].end + 1);
-      params[i].end = ((i == (cmd_args->exec_thread_num - 1)) ?
-		       bin_num - 1 :
-		       ((bin_num / cmd_args->exec_thread_num) * (i + 1) - 1));
-      params[i].k = cmd_args-> k;
-      params[i].res = cmd_args->res;
-      params[i].seq = seq;
-      params[i].kmer_freq = kmer_freq;
-    }
+/**
+ * count the k-mers of the seq_len / res bins of a sequence
+ *  into rows bin_offset, bin_offset + 1, ... of kc
+ *  (a sparse table must have been created for this sequence alone,
+ *  with bin_offset 0)
+ */
+int kmer_freq_count_seq(const command_line_arguements *cmd_args,
+			thread_pool *pool,
+			const char *seq,
+			const unsigned long seq_len,
+			kmer_count *kc,
+			const unsigned long bin_offset,
+			unsigned long *skipped,
+			unsigned long *saturated){
+  const unsigned long bin_num = seq_len / cmd_args->res;
+  unsigned long next_bin = 0, *offset = NULL;
+  unsigned char nt_code[256];
+  int *owner = NULL;
+  kmer_freq_count_args *params;
+  int i;
+
+  if(kc->ptr != NULL && bin_offset != 0){
+    fprintf(stderr, "error: kmer_freq_count_seq: sparse table with an offset\n");
+    exit(EXIT_FAILURE);
+  }
+  if(kc->ptr != NULL){
+    owner = calloc_errchk(bin_num + 1, sizeof(int),
+			  "calloc: kmer_freq owner");
+    offset = calloc_errchk(bin_num + 1, sizeof(unsigned long),
+			   "calloc: kmer_freq offset");
+  }
 
-    /* pthread create */
-    for(i = 0; i < cmd_args->exec_thread_num; i++){
-      pthread_create(&threads[i], NULL, 
-		     kmer_freq_count,
-		     (void*)&params[i]);
-    }
+  set_nt_code(nt_code);
 
-    /* pthread join */
-    for(i = 0; i < cmd_args->exec_thread_num; i++){
-      pthread_join(threads[i], NULL);
-    }
+  /* count k-mer frequency */
+  params = calloc_errchk(pool->thread_num,
+			 sizeof(kmer_freq_count_args),
+			 "calloc: kmer_freq_count_args");
+  for(i = 0; i < pool->thread_num; i++){
+    params[i].thread_id = i;
+    params[i].next_bin = &next_bin;
+    params[i].bin_num = bin_num;
+    params[i].k = cmd_args->k;
+    params[i].res = cmd_args->res;
+    params[i].seq = seq;
+    params[i].seq_len = seq_len;
+    params[i].nt_code = nt_code;
+    params[i].kc = kc;
+    params[i].bin_offset = bin_offset;
+    params[i].sparse = (kc->ptr != NULL);
+    params[i].owner = owner;
+    params[i].offset = offset;
   }
-
-  {
-    unsigned int i, j;
-    for(i = 0; i < bin_num; i++){
-      fprintf(stderr, "%10d: ", i);
-      if(kmer_freq[i] != NULL){
-	for(j = 0; j < (1 << (2 * (cmd_args->k))); j++){
-	  fprintf(stderr, "%d", kmer_freq[i][j] > 0 ? 1 : 0);
-	}
-	fprintf(stderr, "\n");
-      }else{
-	fprintf(stderr, "*\n");
-      }
+  thread_pool_exec(pool, kmer_freq_count,
+		   params, sizeof(kmer_freq_count_args));
+  *skipped = *saturated = 0;
+  for(i = 0; i < pool->thread_num; i++){
+    *skipped += params[i].skipped;
+    *saturated += params[i].saturated;
+  }
+  if(kc->ptr != NULL){
+    kmer_count_sparse_alloc(kc);
+    thread_pool_exec(pool, kmer_freq_merge_sparse,
+		     params, sizeof(kmer_freq_count_args));
+    for(i = 0; i < pool->thread_num; i++){
+      *saturated += params[i].saturated;
     }
+    free(owner);
+    free(offset);
   }
+  free(params);
+  return 0;
+}
 
+int set_kmer_freq(const command_line_arguements *cmd_args,
+		  thread_pool *pool,
+		  kmer_count **kc){
+  fasta *fa;
+  unsigned long bin_num, skipped, saturated;
+  unsigned int width;
 
-  free(seq);
-  free(seq_head);
+  /* read fasta file */
+  fasta_read(cmd_args->fasta_file, &fa);
+
+  bin_num = (fa->seq_len / cmd_args->res);
+
+  fprintf(stderr, "%s: info: sequence: %s (%ld : %ld)\n", 
+	  cmd_args->prog_name, fa->head, fa->seq_len, bin_num);
+
+  /* allocate memory for k-mer frequency table */  
+  width = kmer_count_width(cmd_args->count_width,
+			   cmd_args->res + cmd_args->k - 1);
+  if(cmd_args->exec_mode_sparse){
+    kmer_count_create_sparse(bin_num, cmd_args->k, width, kc);
+  }else{
+    kmer_count_create(bin_num, cmd_args->k, width, kc);
+  }
+
+  kmer_freq_count_seq(cmd_args, pool, fa->seq, fa->seq_len, *kc, 0,
+		      &skipped, &saturated);
 
-  show_info(stderr, cmd_args->prog_name, 
-	    "Complete k-mer frequency table computation");
+  fprintf(stderr, "%s: info: k-mer frequency: %ld bins skipped (N), %d-bit counts\n", 
+	  cmd_args->prog_name, skipped, 8 * (*kc)->width);
+  if(cmd_args->exec_mode_sparse){
+    fprintf(stderr, "%s: info: k-mer frequency: sparse, %ld entries (%.1f per bin)\n", 
+	    cmd_args->prog_name, (*kc)->ptr[bin_num],
+	    (bin_num > skipped) ? (double)(*kc)->ptr[bin_num] / (bin_num - skipped) : 0.0);
+  }
+  if(saturated > 0){
+    fprintf(stderr, "%s: warning: k-mer frequency: %ld counts saturated at %d bits\n", 
+	    cmd_args->prog_name, saturated, 8 * (*kc)->width);
+  }
 
+  fasta_free(fa);
   return 0;
 }
-#endif
+
 #endif
@@ -12,8 +12,11 @@ typedef struct _filenames {
   char *hic;
   char *histo;
   char *adaboost;
+  char *checkpoint;
   char *qp_P;
   char *qp_q;
+  char *qp_x;
+  char *results;
 } filenames;
 
 int show_filenames(FILE *fp,
@@ -22,13 +25,18 @@ int show_filenames(FILE *fp,
   fprintf(fp, "%s\n", fnames->hic);
   fprintf(fp, "%s\n", fnames->histo);
   fprintf(fp, "%s\n", fnames->adaboost);
+  fprintf(fp, "%s\n", fnames->checkpoint);
   fprintf(fp, "%s\n", fnames->qp_P);
   fprintf(fp, "%s\n", fnames->qp_q);
+  fprintf(fp, "%s\n", fnames->qp_x);
+  fprintf(fp, "%s\n", fnames->results);
   return 0;
 }
 
 
+/* file names of the model learned for the given percentile */
 int set_filenames(const command_line_arguements *args,
+		  const double percentile,
 		  filenames **fnames){
   char *header;
   *fnames = calloc_errchk(1, sizeof(filenames), "calloc: filenames");
@@ -56,14 +64,25 @@ int set_filenames(const command_line_arguements *args,
 
     sprintf((*fnames)->kmer_freq, "%s/%s.k%d.res%dk.freq", 
 	    args->output_dir, buf, args->k, (args->res) / 1000);	    	   
+
+    /* --kmerFreq */
+    if(args->kmerFreq_file != NULL){
+      strncpy((*fnames)->kmer_freq, args->kmerFreq_file, F_NAME_LEN - 1);
+    }
   }
 
   { /* common header */
+    char chr[16];
+    if(args->chr_num > 0){
+      sprintf(chr, "genome");
+    }else{
+      sprintf(chr, "chr%d", args->chr);
+    }
     header = calloc_errchk(F_NAME_LEN, sizeof(char), "calloc: fnames: header");
     sprintf(header, 
-	    "%s/chr%d.m%dk.M%dk.%s.%s",
+	    "%s/%s.m%dk.M%dk.%s.%s",
 	    args->output_dir,
-	    args->chr,
+	    chr,
 	    (args->min_size) / 1000,
 	    (args->max_size) / 1000,
 	    args->norm,
@@ -74,6 +93,11 @@ int set_filenames(const command_line_arguements *args,
     (*fnames)->hic = calloc_errchk(F_NAME_LEN, sizeof(char),
 					"fnames->hic");
     sprintf((*fnames)->hic, "%s.hic", header);
+
+    /* --hic */
+    if(args->hic_file != NULL){
+      strncpy((*fnames)->hic, args->hic_file, F_NAME_LEN - 1);
+    }
   }
 
   { /* histo */
@@ -86,8 +110,13 @@ int set_filenames(const command_line_arguements *args,
     (*fnames)->adaboost = calloc_errchk(F_NAME_LEN, sizeof(char),
 					"fnames->adaboost");
     sprintf((*fnames)->adaboost, "%s.k%d.res%dk.p%d.T%ld.stamps", header, 
-	    args->k, (args->res) / 1000, (int)(100 * (args->percentile)),
+	    args->k, (args->res) / 1000, (int)(100 * percentile),
 	    args->iteration_num);
+    /* independent of T, so that a model can be extended */
+    (*fnames)->checkpoint = calloc_errchk(F_NAME_LEN, sizeof(char),
+					  "fnames->checkpoint");
+    sprintf((*fnames)->checkpoint, "%s.k%d.res%dk.p%d.ckpt", header, 
+	    args->k, (args->res) / 1000, (int)(100 * percentile));
   }
   { /* QP */
     (*fnames)->qp_P = calloc_errchk(F_NAME_LEN, sizeof(char),
@@ -95,10 +124,22 @@ int set_filenames(const command_line_arguements *args,
     (*fnames)->qp_q = calloc_errchk(F_NAME_LEN, sizeof(char),
 				    "fnames->qp_q");
     sprintf((*fnames)->qp_P, "%s.k%d.res%dk.p%d.T%ld.P", header,
-	    args->k, (args->res) / 1000, (int)(100 * (args->percentile)),
+	    args->k, (args->res) / 1000, (int)(100 * percentile),
 	    args->iteration_num);
     sprintf((*fnames)->qp_q, "%s.k%d.res%dk.p%d.T%ld.q", header,
-	    args->k, (args->res) / 1000, (int)(100 * (args->percentile)),
+	    args->k, (args->res) / 1000, (int)(100 * percentile),
+	    args->iteration_num);
+  }
+  { /* QP solution */
+    (*fnames)->qp_x = calloc_errchk(F_NAME_LEN, sizeof(char),
+				    "fnames->qp_x");
+    (*fnames)->results = calloc_errchk(F_NAME_LEN, sizeof(char),
+				       "fnames->results");
+    sprintf((*fnames)->qp_x, "%s.k%d.res%dk.p%d.T%ld.QP", header,
+	    args->k, (args->res) / 1000, (int)(100 * percentile),
+	    args->iteration_num);
+    sprintf((*fnames)->results, "%s.k%d.res%dk.p%d.T%ld.results", header,
+	    args->k, (args->res) / 1000, (int)(100 * percentile),
 	    args->iteration_num);
   }
 
@@ -0,0 +1,463 @@
+#ifndef __GENOME_H__
+#define __GENOME_H__
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include "cmd_args.h"
+#include "calloc_errchk.h"
+#include "io.h"
+#include "thread_pool.h"
+#include "kmer_count.h"
+#include "fasta.h"
+#include "hic.h"
+
+/**
+ * genome mode (--chrList)
+ *  the chromosomes of a multi-FASTA are preprocessed as independent
+ *  jobs (sequence, k-mer counting, Hi-C ingest) and concatenated into
+ *  one k-mer table and one contact set: the bins of the c-th chromosome
+ *  of the list are [bin_offset, bin_offset + bin_num) of the genome.
+ *  Jobs run concurrently as long as the sum of their estimated memory
+ *  (plus the dense genome table) stays within --memBudget; the largest
+ *  jobs are started first and a job is always started when nothing
+ *  else is running. A job gets its threads when it starts: the free
+ *  threads are shared among the jobs that the budget lets start now.
+ */
+
+typedef struct _genome_chr {
+  /* name as in --chrList (and in the Hi-C directory as chr<name>) */
+  const char *name;
+  /* record body in the mapped multi-FASTA */
+  const char *body;
+  const char *body_end;
+  unsigned long seq_len;
+  unsigned long bin_num;
+  unsigned long bin_offset;
+  /* estimated peak memory of the job (bytes) */
+  size_t mem;
+  /* results of the job */
+  kmer_count *kc;
+  hic *data;
+  unsigned long skipped;
+  unsigned long saturated;
+} genome_chr;
+
+typedef struct _genome {
+  const char *map;
+  size_t map_len;
+  unsigned int chr_num;
+  genome_chr *chrs;
+  unsigned long bin_num;
+} genome;
+
+/* job queue shared by the workers */
+typedef struct _genome_sched {
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+  /* memory budget (0: unlimited) and memory of the running jobs */
+  size_t budget;
+  size_t in_use;
+  unsigned int running;
+  /* threads of the pool not given to a running job */
+  int free_threads;
+  /* jobs by decreasing memory; order[next] is the next to start */
+  unsigned int *order;
+  unsigned int next;
+} genome_sched;
+
+typedef struct _genome_thread_args {
+  int thread_id;
+  const command_line_arguements *cmd_args;
+  genome *g;
+  genome_sched *sched;
+  /* dense k-mer table of the genome (NULL in sparse mode) */
+  kmer_count *kc;
+} genome_thread_args;
+
+/* does a FASTA header (without '>') name chromosome name (with or without "chr") */
+static inline int genome_header_match(const char *head,
+				      const char *eol,
+				      const char *name){
+  const char *end = io_token_end(head, eol);
+  const size_t len = strlen(name);
+
+  if((size_t)(end - head) == len + 3 && strncmp(head, "chr", 3) == 0){
+    head += 3;
+  }
+  return ((size_t)(end - head) == len && strncmp(head, name, len) == 0);
+}
+
+/**
+ * map the multi-FASTA file and locate the records of the chromosomes
+ * in the list (the number of bases is counted in the same scan)
+ */
+int genome_index(const command_line_arguements *cmd_args,
+		 genome **g){
+  const char *p, *eol, *stop;
+  genome_chr *chr = NULL;
+  unsigned int c;
+
+  *g = calloc_errchk(1, sizeof(genome), "calloc: genome");
+  (*g)->chr_num = cmd_args->chr_num;
+  (*g)->chrs = calloc_errchk(cmd_args->chr_num, sizeof(genome_chr),
+			     "calloc: genome chrs");
+  for(c = 0; c < cmd_args->chr_num; c++){
+    (*g)->chrs[c].name = cmd_args->chr_names[c];
+  }
+
+  io_map(cmd_args->fasta_file, &((*g)->map), &((*g)->map_len));
+  p = (*g)->map;
+  stop = (*g)->map + (*g)->map_len;
+  while(p < stop){
+    eol = io_eol(p, stop);
+    if(*p == '>'){
+      if(chr != NULL){
+	chr->body_end = p;
+      }
+      chr = NULL;
+      for(c = 0; c < (*g)->chr_num; c++){
+	if(genome_header_match(p + 1, eol, (*g)->chrs[c].name)){
+	  if((*g)->chrs[c].body != NULL){
+	    fprintf(stderr, "error: %s: chr%s appears twice\n",
+		    cmd_args->fasta_file, (*g)->chrs[c].name);
+	    exit(EXIT_FAILURE);
+	  }
+	  chr = &((*g)->chrs[c]);
+	  chr->body = (eol < stop) ? eol + 1 : stop;
+	  break;
+	}
+      }
+    }else if(chr != NULL){
+      chr->seq_len += eol - p;
+      if(eol > p && eol[-1] == '\r'){
+	chr->seq_len--;
+      }
+    }
+    p = eol + 1;
+  }
+  if(chr != NULL){
+    chr->body_end = stop;
+  }
+
+  for(c = 0; c < (*g)->chr_num; c++){
+    chr = &((*g)->chrs[c]);
+    if(chr->body == NULL){
+      fprintf(stderr, "error: %s: chr%s not found\n",
+	      cmd_args->fasta_file, chr->name);
+      exit(EXIT_FAILURE);
+    }
+    chr->bin_num = chr->seq_len / cmd_args->res;
+    chr->bin_offset = (*g)->bin_num;
+    (*g)->bin_num += chr->bin_num;
+  }
+  return 0;
+}
+
+/**
+ * estimated peak memory of a job: the joined sequence, the mapped
+ * RAWobserved file (the retained contacts take at most about as much)
+ * and, in sparse mode, the profiles of the chromosome (at most res
+ * entries per bin, kept twice while they are merged)
+ */
+size_t genome_job_mem(const command_line_arguements *cmd_args,
+		      const genome_chr *chr){
+  char *hic_raw_file, *hic_norm_file, *hic_exp_file;
+  struct stat stbuf;
+  size_t mem = chr->seq_len;
+
+  set_hic_file_names(cmd_args->hicRaw_dir, cmd_args->res, chr->name,
+		     NULL, NULL,
+		     &hic_raw_file, &hic_norm_file, &hic_exp_file);
+  if(stat(hic_raw_file, &stbuf) == -1){
+    fprintf(stderr, "error: stat %s\n%s\n",
+	    hic_raw_file, strerror(errno));
+    exit(EXIT_FAILURE);
+  }
+  mem += 2 * stbuf.st_size;
+  if(cmd_args->exec_mode_sparse != 0){
+    mem += chr->bin_num * cmd_args->res *
+      (2 * sizeof(uint32_t) + sizeof(uint32_t) +
+       kmer_count_width(cmd_args->count_width,
+			cmd_args->res + cmd_args->k - 1));
+  }
+  free(hic_raw_file);
+  return mem;
+}
+
+/* preprocess one chromosome */
+void genome_job(const command_line_arguements *cmd_args,
+		thread_pool *pool,
+		genome_chr *chr,
+		kmer_count *kc){
+  fasta fa;
+
+  memset(&fa, 0, sizeof(fasta));
+  fasta_set_seq(&fa, chr->body, chr->body_end);
+
+  if(kc == NULL){
+    /* sparse: profiles of this chromosome, concatenated later */
+    kmer_count_create_sparse(chr->bin_num, cmd_args->k,
+			     kmer_count_width(cmd_args->count_width,
+					      cmd_args->res + cmd_args->k - 1),
+			     &(chr->kc));
+    kmer_freq_count_seq(cmd_args, pool, fa.seq, fa.seq_len, chr->kc, 0,
+			&(chr->skipped), &(chr->saturated));
+    free(fa.buf);
+    hic_prep_chr(cmd_args, pool, chr->name, chr->kc, 0,
+		 chr->bin_offset, chr->bin_num, &(chr->data));
+  }else{
+    /* dense: rows of the genome table */
+    kmer_freq_count_seq(cmd_args, pool, fa.seq, fa.seq_len, kc,
+			chr->bin_offset, &(chr->skipped), &(chr->saturated));
+    free(fa.buf);
+    hic_prep_chr(cmd_args, pool, chr->name, kc, chr->bin_offset,
+		 chr->bin_offset, chr->bin_num, &(chr->data));
+  }
+
+  fprintf(stderr, "%s: info: genome: chr%s: %ld bins (%ld skipped), %ld contacts\n",
+	  cmd_args->prog_name, chr->name, chr->bin_num, chr->skipped,
+	  chr->data->nrow);
+}
+
+/* 1 if the next job of the queue fits into the memory budget */
+static inline int genome_sched_fits(const genome_sched *sched,
+				    const genome *g){
+  return (sched->budget == 0 ||
+	  sched->in_use + g->chrs[sched->order[sched->next]].mem <= sched->budget);
+}
+
+/**
+ * threads for a job that has just been taken from the queue: the free
+ * threads divided by the number of jobs that can start now (this one
+ * and the following jobs of the queue that fit into the remaining
+ * budget, at most one per free thread)
+ */
+static inline int genome_sched_threads(const genome_sched *sched,
+				       const genome *g){
+  unsigned int next;
+  int startable = 1;
+  size_t in_use = sched->in_use;
+
+  for(next = sched->next; next < g->chr_num; next++){
+    if(startable >= sched->free_threads ||
+       (sched->budget > 0 && in_use + g->chrs[sched->order[next]].mem > sched->budget)){
+      break;
+    }
+    in_use += g->chrs[sched->order[next]].mem;
+    startable++;
+  }
+  return sched->free_threads / startable;
+}
+
+/* take jobs from the queue while the memory budget allows */
+void *genome_thread(void *args){
+  genome_thread_args *params = (genome_thread_args *)args;
+  genome_sched *sched = params->sched;
+  thread_pool *pool;
+  genome_chr *chr;
+  int job_thread_num;
+
+  while(1){
+    pthread_mutex_lock(&(sched->mutex));
+    while(sched->next < params->g->chr_num && sched->running > 0 &&
+	  (sched->free_threads == 0 || genome_sched_fits(sched, params->g) == 0)){
+      pthread_cond_wait(&(sched->cond), &(sched->mutex));
+    }
+    if(sched->next >= params->g->chr_num){
+      pthread_mutex_unlock(&(sched->mutex));
+      break;
+    }
+    chr = &(params->g->chrs[sched->order[(sched->next)++]]);
+    sched->in_use += chr->mem;
+    job_thread_num = genome_sched_threads(sched, params->g);
+    sched->free_threads -= job_thread_num;
+    sched->running++;
+    pthread_mutex_unlock(&(sched->mutex));
+
+    thread_pool_create(job_thread_num, &pool);
+    genome_job(params->cmd_args, pool, chr, params->kc);
+    thread_pool_destroy(pool);
+
+    pthread_mutex_lock(&(sched->mutex));
+    sched->in_use -= chr->mem;
+    sched->free_threads += job_thread_num;
+    sched->running--;
+    pthread_cond_broadcast(&(sched->cond));
+    pthread_mutex_unlock(&(sched->mutex));
+  }
+  return NULL;
+}
+
+/* concatenate the sparse profiles of the chromosomes */
+int genome_merge_sparse(const command_line_arguements *cmd_args,
+			genome *g,
+			kmer_count **kc){
+  unsigned long entries = 0, bin, base;
+  unsigned int c;
+  genome_chr *chr;
+
+  kmer_count_create_sparse(g->bin_num, cmd_args->k,
+			   kmer_count_width(cmd_args->count_width,
+					    cmd_args->res + cmd_args->k - 1),
+			   kc);
+  for(c = 0; c < g->chr_num; c++){
+    entries += g->chrs[c].kc->ptr[g->chrs[c].bin_num];
+  }
+  (*kc)->ids = calloc_errchk(entries + 1, sizeof(uint32_t),
+			     "calloc: kmer_count->ids");
+  (*kc)->vals = calloc_errchk(entries + 1, (*kc)->width,
+			      "calloc: kmer_count->vals");
+  for(c = 0; c < g->chr_num; c++){
+    chr = &(g->chrs[c]);
+    base = (*kc)->ptr[chr->bin_offset];
+    for(bin = 0; bin < chr->bin_num; bin++){
+      (*kc)->ptr[chr->bin_offset + bin + 1] = base + chr->kc->ptr[bin + 1];
+      if(kmer_count_valid(chr->kc, bin)){
+	kmer_count_set_valid(*kc, chr->bin_offset + bin);
+      }
+    }
+    memcpy((*kc)->ids + base, chr->kc->ids,
+	   chr->kc->ptr[chr->bin_num] * sizeof(uint32_t));
+    memcpy((*kc)->vals + base * (*kc)->width, chr->kc->vals,
+	   chr->kc->ptr[chr->bin_num] * (*kc)->width);
+    kmer_count_free(chr->kc);
+    chr->kc = NULL;
+  }
+  return 0;
+}
+
+/* concatenate the contacts of the chromosomes */
+int genome_merge_hic(const command_line_arguements *cmd_args,
+		     genome *g,
+		     hic **data){
+  unsigned long nrow = 0;
+  unsigned int c;
+  hic *part;
+
+  for(c = 0; c < g->chr_num; c++){
+    nrow += g->chrs[c].data->nrow;
+  }
+  *data = calloc_errchk(1, sizeof(hic), "calloc hic");
+  (*data)->nrow = nrow;
+  (*data)->res = cmd_args->res;
+  (*data)->i = calloc_errchk(nrow, sizeof(unsigned int),
+			     "calloc hic (*data)->i");
+  (*data)->j = calloc_errchk(nrow, sizeof(unsigned int),
+			     "calloc hic (*data)->j");
+  (*data)->mij = calloc_errchk(nrow, sizeof(double),
+			       "calloc hic (*data)->mij");
+
+  nrow = 0;
+  for(c = 0; c < g->chr_num; c++){
+    part = g->chrs[c].data;
+    memcpy((*data)->i + nrow, part->i, part->nrow * sizeof(unsigned int));
+    memcpy((*data)->j + nrow, part->j, part->nrow * sizeof(unsigned int));
+    memcpy((*data)->mij + nrow, part->mij, part->nrow * sizeof(double));
+    nrow += part->nrow;
+    free(part->i);
+    free(part->j);
+    free(part->mij);
+    free(part);
+    g->chrs[c].data = NULL;
+  }
+  return 0;
+}
+
+/**
+ * k-mer table and contact set of the chromosomes in --chrList
+ *  (the pool's threads are split among the concurrent jobs)
+ */
+int genome_prep(const command_line_arguements *cmd_args,
+		thread_pool *pool,
+		kmer_count **kc,
+		hic **data){
+  genome *g;
+  genome_sched sched;
+  genome_thread_args *params;
+  unsigned long skipped = 0, saturated = 0;
+  unsigned int c;
+  int t;
+
+  genome_index(cmd_args, &g);
+  fprintf(stderr, "%s: info: genome: %d chromosomes, %ld bins\n",
+	  cmd_args->prog_name, g->chr_num, g->bin_num);
+
+  memset(&sched, 0, sizeof(genome_sched));
+  pthread_mutex_init(&(sched.mutex), NULL);
+  pthread_cond_init(&(sched.cond), NULL);
+  sched.budget = cmd_args->mem_budget << 20;
+  sched.order = calloc_errchk(g->chr_num, sizeof(unsigned int),
+			      "calloc: genome order");
+  for(c = 0; c < g->chr_num; c++){
+    unsigned int d;
+    g->chrs[c].mem = genome_job_mem(cmd_args, &(g->chrs[c]));
+    /* insertion by decreasing memory (stable) */
+    for(d = c; d > 0 && g->chrs[sched.order[d - 1]].mem < g->chrs[c].mem; d--){
+      sched.order[d] = sched.order[d - 1];
+    }
+    sched.order[d] = c;
+  }
+
+  *kc = NULL;
+  if(cmd_args->exec_mode_sparse == 0){
+    kmer_count_create(g->bin_num, cmd_args->k,
+		      kmer_count_width(cmd_args->count_width,
+				       cmd_args->res + cmd_args->k - 1),
+		      kc);
+    /* the table is filled by the jobs and stays for the whole run */
+    sched.in_use = g->bin_num * (*kc)->row_bytes;
+    fprintf(stderr, "%s: info: genome: dense k-mer table: %ld MB\n",
+	    cmd_args->prog_name, (unsigned long)(sched.in_use >> 20));
+    if(sched.budget > 0 && sched.in_use > sched.budget){
+      fprintf(stderr, "%s: warning: genome: the k-mer table exceeds the memory budget, "
+	      "chromosomes are preprocessed one at a time\n", cmd_args->prog_name);
+    }
+  }
+  sched.free_threads = pool->thread_num;
+
+  params = calloc_errchk(pool->thread_num, sizeof(genome_thread_args),
+			 "calloc: genome_thread_args");
+  for(t = 0; t < pool->thread_num; t++){
+    params[t].thread_id = t;
+    params[t].cmd_args = cmd_args;
+    params[t].g = g;
+    params[t].sched = &sched;
+    params[t].kc = *kc;
+  }
+  thread_pool_exec(pool, genome_thread,
+		   params, sizeof(genome_thread_args));
+
+  for(c = 0; c < g->chr_num; c++){
+    skipped += g->chrs[c].skipped;
+    saturated += g->chrs[c].saturated;
+  }
+  if(cmd_args->exec_mode_sparse != 0){
+    genome_merge_sparse(cmd_args, g, kc);
+  }
+  genome_merge_hic(cmd_args, g, data);
+
+  fprintf(stderr, "%s: info: k-mer frequency: %ld bins skipped (N), %d-bit counts\n",
+	  cmd_args->prog_name, skipped, 8 * (*kc)->width);
+  if(saturated > 0){
+    fprintf(stderr, "%s: warning: k-mer frequency: %ld counts saturated at %d bits\n",
+	    cmd_args->prog_name, saturated, 8 * (*kc)->width);
+  }
+  fprintf(stderr, "%s: info: Hi-C: genome: %ld contacts\n",
+	  cmd_args->prog_name, (*data)->nrow);
+
+  pthread_mutex_destroy(&(sched.mutex));
+  pthread_cond_destroy(&(sched.cond));
+  io_unmap(g->map, g->map_len);
+  free(sched.order);
+  free(params);
+  free(g->chrs);
+  free(g);
+  return 0;
+}
+
+#endif
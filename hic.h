@@ -3,6 +3,8 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <math.h>
 #include <unistd.h>
 #include <pthread.h>
 
@@ -12,140 +14,245 @@
 #include "calloc_errchk.h"
 #include "diffSec.h"
 #include "io.h"
+#include "thread_pool.h"
+#include "kmer_count.h"
 
 /* normalized O/E converted Hi-C data */
 typedef struct _hic {
   unsigned long nrow;
   unsigned int res;
-  unsigned int *invalid;
   unsigned int *i;
   unsigned int *j;
   double *mij;
+  /**
+   * bin-blocked (CSR) layout, set by hic_block
+   *  rows are sorted by (i, j) and the rows of anchor bin b are
+   *  [row_ptr[b], row_ptr[b + 1]); row_ptr is NULL if not blocked
+   */
+  unsigned long bin_num;
+  unsigned long *row_ptr;
+  /**
+   * mapping of a cache file (see cache.h) that i, j and mij point
+   * into, NULL if they are allocated
+   */
+  void *map;
+  size_t map_len;
 } hic;
 
-/* Hi-C raw data */
-typedef struct _hic_raw{
-  hic *hic;
-  double *norm;
-  double *exp;
-  unsigned long norm_len;
-  unsigned long exp_len;
-} hic_raw;
+/* initial capacity of the per-thread contact buffers */
+#define HIC_BUF_INIT 4096
 
-/* arguments for function hic_prep_thread */
-typedef struct _hic_prep_thread_args{
+/* contacts retained by one thread (grown by doubling) */
+typedef struct _hic_buf {
+  unsigned long num;
+  unsigned long size;
+  unsigned int *i;
+  unsigned int *j;
+  double *mij;
+} hic_buf;
+
+/* arguments for functions hic_read_thread_* */
+typedef struct _hic_read_thread_args{
   int thread_id;
-  unsigned long begin;
-  unsigned long end;
+  /* chunk of the file (whole lines) */
+  const char *begin;
+  const char *end;
+  unsigned int res;
+  /* size selection */
   unsigned long min_dist;
   unsigned long max_dist;
-  unsigned int *h_invalid;
+  /* normalization and O/E vectors (NULL if not used) */
+  const double *norm;
+  unsigned long norm_len;
+  const double *exp;
+  unsigned long exp_len;
+  /**
+   * bins without k-mer profile are dropped
+   *  bin b of the chromosome (b < bin_num) is row kc_offset + b of kc
+   *  and is stored as bin_offset + b
+   */
+  const kmer_count *kc;
+  unsigned long kc_offset;
+  unsigned long bin_offset;
+  unsigned long bin_num;
+  /* retained contacts */
+  hic_buf buf;
+  /* statistics */
+  unsigned long row_num;
+  unsigned long out_of_range;
+  unsigned long not_finite;
+  unsigned long no_kmer;
+  /* rows of this chunk in the merged data are [row_begin, row_begin + buf.num) */
+  unsigned long row_begin;
   unsigned int *h_i;
   unsigned int *h_j;
   double *h_mij;
-  double *norm;
-  double *exp;
-} hic_prep_thread_args;
+} hic_read_thread_args;
+
+static inline void hic_buf_push(hic_buf *buf,
+				const unsigned int i,
+				const unsigned int j,
+				const double mij){
+  if(buf->num == buf->size){
+    buf->size = (buf->size == 0) ? HIC_BUF_INIT : 2 * buf->size;
+    if((buf->i = realloc(buf->i, buf->size * sizeof(unsigned int))) == NULL ||
+       (buf->j = realloc(buf->j, buf->size * sizeof(unsigned int))) == NULL ||
+       (buf->mij = realloc(buf->mij, buf->size * sizeof(double))) == NULL){
+      fprintf(stderr, "error: realloc hic_buf\n");
+      exit(EXIT_FAILURE);
+    }
+  }
+  (buf->i)[buf->num] = i;
+  (buf->j)[buf->num] = j;
+  (buf->mij)[buf->num++] = mij;
+}
 
 /**
- * read Hi-C data from a file 
+ * parse "i<TAB>j<TAB>mij" lines and keep the contacts that
+ *  - are within [min_dist, max_dist]
+ *  - have a finite value after normalization and/or O/E conversion
+ *  - have k-mer profiles on both ends
  */
-
-int hic_read(const char *hic_file,
-	     const unsigned int res,
-	     hic **data){
-
-  /* allocate memory */
-  *data = calloc_errchk(1, sizeof(hic), "calloc hic");
-  {
-    (*data)->nrow = mywc(hic_file);  
-    (*data)->invalid = calloc_errchk((*data)->nrow, sizeof(unsigned int),
-				     "calloc hic (*data)->invalid");
-    (*data)->i = calloc_errchk((*data)->nrow, sizeof(unsigned int),
-			       "calloc hic (*data)->i");
-    (*data)->j = calloc_errchk((*data)->nrow, sizeof(unsigned int),
-			       "calloc hic (*data)->j");
-    (*data)->mij = calloc_errchk((*data)->nrow, sizeof(double), 
-				 "calloc hic (*data)->mij");
-    (*data)->res = res;
-  }
-
-  /* read from a file */
-  {
-    FILE *fp;
-    char buf[256], tmp_mij_str[64];
-    unsigned int tmp_i = 0, tmp_j = 0;
-    unsigned long row = 0;
-
-    if((fp = fopen(hic_file, "r")) == NULL){
-      fprintf(stderr, "error: fopen %s\n%s\n",
-	      hic_file, strerror(errno));
-      exit(EXIT_FAILURE);
-    }
-    
-    while(fgets(buf, BUF_SIZE, fp) && row < (*data)->nrow){
-      sscanf(buf, "%d\t%d\t%s", &tmp_i, &tmp_j, (char *)(&tmp_mij_str));	 
-      ((*data)->mij)[row] = strtod(tmp_mij_str, NULL);	  
+void *hic_read_thread(void *args){
+  hic_read_thread_args *params = (hic_read_thread_args *)args;
+  const char *p = params->begin, *eol;
+  unsigned long tmp_i, tmp_j, bin_i, bin_j, ij_dist;
+  double mij;
+
+  while(p < params->end){
+    eol = io_eol(p, params->end);
+    if(io_blank(p, eol) == 0){
+      params->row_num++;
+      tmp_i = io_parse_long(&p, eol);
+      tmp_j = io_parse_long(&p, eol);
+      mij = io_parse_double(&p, eol);
       if(tmp_i <= tmp_j){
-	((*data)->i)[row] = tmp_i / res;
-	((*data)->j)[row] = tmp_j / res;
+	bin_i = tmp_i / params->res;
+	bin_j = tmp_j / params->res;
+      }else{
+	bin_i = tmp_j / params->res;
+	bin_j = tmp_i / params->res;
+      }
+      ij_dist = bin_j - bin_i;
+
+      if(ij_dist < params->min_dist || params->max_dist < ij_dist){
+	params->out_of_range++;
       }else{
-	((*data)->i)[row] = tmp_j / res;
-	((*data)->j)[row] = tmp_i / res;
+	if(params->norm != NULL && params->exp != NULL){
+	  mij = (bin_j < params->norm_len && ij_dist < params->exp_len) ?
+	    mij / ((params->norm)[bin_i] * (params->norm)[bin_j] *
+		   (params->exp)[ij_dist]) : NAN;
+	}else if(params->norm != NULL){
+	  mij = (bin_j < params->norm_len) ?
+	    mij / ((params->norm)[bin_i] * (params->norm)[bin_j]) : NAN;
+	}else if(params->exp != NULL){
+	  mij = (ij_dist < params->exp_len) ?
+	    mij / (params->exp)[ij_dist] : NAN;
+	}
+
+	if(isnan(mij) || isinf(mij)){
+	  params->not_finite++;
+	}else if(bin_j >= params->bin_num ||
+		 kmer_count_valid(params->kc, params->kc_offset + bin_i) == 0 ||
+		 kmer_count_valid(params->kc, params->kc_offset + bin_j) == 0){
+	  params->no_kmer++;
+	}else{
+	  hic_buf_push(&(params->buf), params->bin_offset + bin_i,
+		       params->bin_offset + bin_j, mij);
+	}
       }
-      row++;
     }
-  
-    fclose(fp);
+    p = eol + 1;
   }
-
-  return 0;
+  return NULL;
 }
 
+/* copy the retained contacts of a chunk into place */
+void *hic_read_thread_merge(void *args){
+  hic_read_thread_args *params = (hic_read_thread_args *)args;
+  memcpy(params->h_i + params->row_begin, params->buf.i,
+	 params->buf.num * sizeof(unsigned int));
+  memcpy(params->h_j + params->row_begin, params->buf.j,
+	 params->buf.num * sizeof(unsigned int));
+  memcpy(params->h_mij + params->row_begin, params->buf.mij,
+	 params->buf.num * sizeof(double));
+  free(params->buf.i);
+  free(params->buf.j);
+  free(params->buf.mij);
+  return NULL;
+}
 
 /**
- * read Hi-C raw data 
+ * Hi-C raw data
  *  - one raw data matrix
  *  - two vectors for normalization and O/E conversion
  */
 
-inline char *res2str(const unsigned int res){
-  switch(res){
-    case 1000:
-      return "1kb";
-    default:
-      fprintf(stderr, "resolution size %d is not supported\n", res);
-     exit(EXIT_FAILURE);
+/* resolution as in the directory names ("1kb", "25kb", "1mb", ...) */
+static inline char *res2str(const unsigned int res,
+			    char *buf,
+			    const size_t buf_len){
+  int len;
+  if(res > 0 && res % 1000000 == 0){
+    len = snprintf(buf, buf_len, "%umb", res / 1000000);
+  }else if(res > 0 && res % 1000 == 0){
+    len = snprintf(buf, buf_len, "%ukb", res / 1000);
+  }else{
+    fprintf(stderr, "resolution size %u is not supported\n", res);
+    exit(EXIT_FAILURE);
+  }
+  if(len < 0 || (size_t)len >= buf_len){
+    fprintf(stderr, "error: resolution size %u is too large\n", res);
+    exit(EXIT_FAILURE);
+  }
+  return buf;
+}
+
+/* exit if snprintf did not fit a file name into F_NAME_LEN */
+static inline void hic_file_name_check(const int len,
+				       const char *file){
+  if(len < 0 || len >= F_NAME_LEN){
+    fprintf(stderr, "error: file name is too long: %s...\n", file);
+    exit(EXIT_FAILURE);
   }
 }
 
 /* set appropriate file names */
-inline void set_hic_file_names(const char *hicDir,
-			       const unsigned int res,
-			       const unsigned int chr,
-			       const char *norm,
-			       const char *exp,
-			       char **hic_raw_file,
-			       char **hic_norm_file,
-			       char **hic_exp_file){
+static inline void set_hic_file_names(const char *hicDir,
+				      const unsigned int res,
+				      const char *chr,
+				      const char *norm,
+				      const char *exp,
+				      char **hic_raw_file,
+				      char **hic_norm_file,
+				      char **hic_exp_file){
   {
-    char file_head[F_NAME_LEN]; 
-    sprintf(file_head, "%s/%s_resolution_intrachromosomal/chr%d/MAPQGE30/chr%d_%s",
-	    hicDir, res2str(res), chr, chr, res2str(res));
+    char file_head[F_NAME_LEN], res_str[16]; 
+    res2str(res, res_str, sizeof(res_str));
+    hic_file_name_check(snprintf(file_head, F_NAME_LEN,
+				 "%s/%s_resolution_intrachromosomal/chr%s/MAPQGE30/chr%s_%s",
+				 hicDir, res_str, chr, chr, res_str),
+			file_head);
     
     *hic_raw_file = calloc_errchk(F_NAME_LEN, sizeof(char), "calloc: hic_raw_file");
-    sprintf(*hic_raw_file, "%s.%s", file_head, "RAWobserved");
+    hic_file_name_check(snprintf(*hic_raw_file, F_NAME_LEN, "%s.%s",
+				 file_head, "RAWobserved"),
+			*hic_raw_file);
 
     if(norm != NULL){
       *hic_norm_file = calloc_errchk(F_NAME_LEN, sizeof(char), "calloc: hic_norm_file");
-      sprintf(*hic_norm_file, "%s.%s%s", file_head, norm, "norm");
+      hic_file_name_check(snprintf(*hic_norm_file, F_NAME_LEN, "%s.%s%s",
+				   file_head, norm, "norm"),
+			  *hic_norm_file);
     }else{
       *hic_norm_file = NULL;
     }
 
     if(exp != NULL){
       *hic_exp_file = calloc_errchk(F_NAME_LEN, sizeof(char), "calloc: hic_exp_file");
-      sprintf(*hic_exp_file, "%s.%s%s", file_head, exp, "expected");
+      hic_file_name_check(snprintf(*hic_exp_file, F_NAME_LEN, "%s.%s%s",
+				   file_head, exp, "expected"),
+			  *hic_exp_file);
     }else{
       *hic_exp_file = NULL;
     }
@@ -154,262 +261,214 @@ inline void set_hic_file_names(const char *hicDir,
   return;
 }
 
-/* read one matrix and two vectors */
-int hic_raw_read(const char *hic_raw_dir,
-		 const unsigned int res,
-		 const unsigned int chr,
-		 const char *norm,
-		 const char *exp,
-		 hic_raw **raw){
-
+/**
+ * read, normalize, size-select and pack the Hi-C data of a chromosome
+ *  The RAWobserved file is mapped and split at line boundaries; each
+ *  thread parses its chunk and keeps only the contacts that pass all
+ *  filters, in file order. The per-thread buffers are then copied into
+ *  place at prefix-summed offsets, so memory is proportional to the
+ *  retained contacts.
+ *  The bin_num bins of the chromosome are rows kc_offset, ... of kc and
+ *  are stored as bin_offset, ... (see hic_read_thread_args).
+ */
+int hic_prep_chr(const command_line_arguements *cmd_args,
+		 thread_pool *pool,
+		 const char *chr,
+		 const kmer_count *kc,
+		 const unsigned long kc_offset,
+		 const unsigned long bin_offset,
+		 const unsigned long bin_num,
+		 hic **data){
   char *hic_raw_file, *hic_norm_file, *hic_exp_file;    
-
-  set_hic_file_names(hic_raw_dir, res, chr, norm, exp,
+  double *norm = NULL, *exp = NULL;
+  unsigned long norm_len = 0, exp_len = 0, nrow = 0, row_num = 0,
+    out_of_range = 0, not_finite = 0, no_kmer = 0;
+  const char *map;
+  size_t map_len, *offsets;
+  hic_read_thread_args *params;
+  int t;
+
+  set_hic_file_names(cmd_args->hicRaw_dir, cmd_args->res, chr,
+		     cmd_args->norm, cmd_args->exp,
 		     &hic_raw_file, 
 		     &hic_norm_file,
 		     &hic_exp_file);
-
-  *raw = calloc_errchk(1, sizeof(hic_raw), "calloc hic_raw raw");
-
   if(hic_norm_file != NULL){
-    read_double(hic_norm_file, &((*raw)->norm), &((*raw)->norm_len));
+    read_double(hic_norm_file, &norm, &norm_len);
   }
   if(hic_exp_file != NULL){
-    read_double(hic_exp_file, &((*raw)->exp), &((*raw)->exp_len));
+    read_double(hic_exp_file, &exp, &exp_len);
+  }
+
+  io_map(hic_raw_file, &map, &map_len);
+
+  params = calloc_errchk(pool->thread_num, sizeof(hic_read_thread_args),
+			 "calloc: hic_read_thread_args");
+  offsets = calloc_errchk(pool->thread_num + 1, sizeof(size_t),
+			  "calloc: hic_prep offsets");
+  io_split_lines(map, map_len, pool->thread_num, offsets);
+  for(t = 0; t < pool->thread_num; t++){
+    params[t].thread_id = t;
+    params[t].begin = map + offsets[t];
+    params[t].end = map + offsets[t + 1];
+    params[t].res = cmd_args->res;
+    params[t].min_dist = cmd_args->min_size / cmd_args->res;
+    params[t].max_dist = cmd_args->max_size / cmd_args->res;
+    params[t].norm = norm;
+    params[t].norm_len = norm_len;
+    params[t].exp = exp;
+    params[t].exp_len = exp_len;
+    params[t].kc = kc;
+    params[t].kc_offset = kc_offset;
+    params[t].bin_offset = bin_offset;
+    params[t].bin_num = bin_num;
+  }
+  thread_pool_exec(pool, hic_read_thread,
+		   params, sizeof(hic_read_thread_args));
+  io_unmap(map, map_len);
+
+  for(t = 0; t < pool->thread_num; t++){
+    params[t].row_begin = nrow;
+    nrow += params[t].buf.num;
+    row_num += params[t].row_num;
+    out_of_range += params[t].out_of_range;
+    not_finite += params[t].not_finite;
+    no_kmer += params[t].no_kmer;
   }
 
-  hic_read(hic_raw_file, res, &((*raw)->hic));
+  /* allocate memory */
+  *data = calloc_errchk(1, sizeof(hic), "calloc hic");
+  {
+    (*data)->nrow = nrow;
+    (*data)->i = calloc_errchk((*data)->nrow, sizeof(unsigned int),
+			       "calloc hic (*data)->i");
+    (*data)->j = calloc_errchk((*data)->nrow, sizeof(unsigned int),
+			       "calloc hic (*data)->j");
+    (*data)->mij = calloc_errchk((*data)->nrow, sizeof(double), 
+				 "calloc hic (*data)->mij");
+    (*data)->res = cmd_args->res;
+  }
 
+  for(t = 0; t < pool->thread_num; t++){
+    params[t].h_i = (*data)->i;
+    params[t].h_j = (*data)->j;
+    params[t].h_mij = (*data)->mij;
+  }
+  thread_pool_exec(pool, hic_read_thread_merge,
+		   params, sizeof(hic_read_thread_args));
+
+  fprintf(stderr, "%s: info: Hi-C: chr%s: %ld contacts read, %ld out of [min_size, max_size], %ld not finite after normalization, %ld without k-mer frequency profile\n",
+	  cmd_args->prog_name, chr, row_num, out_of_range, not_finite, no_kmer);
+  fprintf(stderr, "%s: info: Hi-C: chr%s: %ld -> %ld\n", 
+	  cmd_args->prog_name, chr, row_num, nrow);
+
+  free(offsets);
+  free(params);
+  free(norm);
+  free(exp);
+  free(hic_raw_file);
+  free(hic_norm_file);
+  free(hic_exp_file);
   return 0;
 }
 
+/* read the Hi-C data of the chromosome given by --chr */
+int hic_prep(const command_line_arguements *cmd_args,
+	     thread_pool *pool,
+	     const kmer_count *kc,
+	     hic **data){
+  char chr[16];
+  sprintf(chr, "%d", cmd_args->chr);
+  hic_prep_chr(cmd_args, pool, chr, kc, 0, 0, kc->bin_num, data);
+  return 0;
+}
 
 /**
- * - normalization and/or O/E conversion
- * - size selection
+ * sort the (packed) contacts by anchor bin i (and by j within a bin)
+ * and set the row pointers of the CSR layout
  */
+int hic_block(hic *data,
+	      const char *prog_name){
+  unsigned long x, b, *count, *pos;
+  unsigned int *i_sorted, *j_sorted;
+  double *mij_sorted;
 
-/* normalization and O/E conversion */
-void *hic_prep_thread_norm_exp(void *args){
-  hic_prep_thread_args *params = (hic_prep_thread_args *)args;
-  unsigned long row, ij_dist;
- 
-  for(row = params-> begin; row <= params -> end; row++){
-    ij_dist = (params->h_j)[row] - (params->h_i)[row];
-
-    if(params->min_dist <= ij_dist && ij_dist <= params->max_dist){
-
-      (params->h_mij)[row] /= ((params->norm)[(params->h_i)[row]] *
-			       (params->norm)[(params->h_j)[row]] *
-			       (params->exp)[(params->h_j)[row] - (params->h_i)[row]]);
-
-      if(isnan((params->h_mij)[row]) || isinf((params->h_mij)[row])){
-	(params->h_invalid)[row] = 1;
-      }
-    }else{
-      (params->h_invalid)[row] = 1;
+  data->bin_num = 0;
+  for(x = 0; x < data->nrow; x++){
+    if((data->j)[x] + 1 > data->bin_num){
+      data->bin_num = (data->j)[x] + 1;
     }
-  }
-
-  return NULL;
-}
-
-/* normalization only */
-void *hic_prep_thread_norm(void *args){
-  hic_prep_thread_args *params = (hic_prep_thread_args *)args;
-  unsigned long row, ij_dist;
-
-  for(row = params-> begin; row <= params -> end; row++){
-    ij_dist = (params->h_j)[row] - (params->h_i)[row];
-
-    if(params->min_dist <= ij_dist && ij_dist <= params->max_dist){
-
-      (params->h_mij)[row] /= ((params->norm)[(params->h_i)[row]] *
-			       (params->norm)[(params->h_j)[row]]);			 
-
-      if(isnan((params->h_mij)[row]) || isinf((params->h_mij)[row])){
-	(params->h_invalid)[row] = 1;
-      }
-    }else{
-      (params->h_invalid)[row] = 1;
+    if((data->i)[x] + 1 > data->bin_num){
+      data->bin_num = (data->i)[x] + 1;
     }
   }
 
-  return NULL;
-}
-
-/* O/E conversion only */
-void *hic_prep_thread_exp(void *args){
-  hic_prep_thread_args *params = (hic_prep_thread_args *)args;
-  unsigned long row, ij_dist;
-
-  for(row = params-> begin; row <= params -> end; row++){
-    ij_dist = (params->h_j)[row] - (params->h_i)[row];
-
-    if(params->min_dist <= ij_dist && ij_dist <= params->max_dist){
-
-      (params->h_mij)[row] /= (params->exp)[(params->h_j)[row] - (params->h_i)[row]];
+  count = calloc_errchk(data->bin_num + 1, sizeof(unsigned long),
+			"calloc: hic_block count");
+  pos = calloc_errchk(data->nrow, sizeof(unsigned long),
+		      "calloc: hic_block pos");
+  i_sorted = calloc_errchk(data->nrow, sizeof(unsigned int),
+			   "calloc: hic_block i");
+  j_sorted = calloc_errchk(data->nrow, sizeof(unsigned int),
+			   "calloc: hic_block j");
+  mij_sorted = calloc_errchk(data->nrow, sizeof(double),
+			     "calloc: hic_block mij");
+
+  /* counting sort by j, then stable counting sort by i */
+  {
+    unsigned long *order;
+    order = calloc_errchk(data->nrow, sizeof(unsigned long),
+			  "calloc: hic_block order");
 
-      if(isnan((params->h_mij)[row]) || isinf((params->h_mij)[row])){
-	(params->h_invalid)[row] = 1;
-      }
-    }else{
-      (params->h_invalid)[row] = 1;
+    for(x = 0; x < data->nrow; x++){
+      count[(data->j)[x] + 1]++;
     }
-  }
-  return NULL;
-}
-
-/* O/E conversion only */
-void *hic_prep_thread(void *args){
-  hic_prep_thread_args *params = (hic_prep_thread_args *)args;
-  unsigned long row, ij_dist;
-  for(row = params-> begin; row <= params -> end; row++){
-    ij_dist = (params->h_j)[row] - (params->h_i)[row];
-
-    if(params->max_dist < ij_dist ||
-       ij_dist < params->min_dist ||
-       isnan((params->h_mij)[row]) ||
-       isinf((params->h_mij)[row])){
-
-      (params->h_invalid)[row] = 1;
+    for(b = 0; b < data->bin_num; b++){
+      count[b + 1] += count[b];
     }
-  }
-  return NULL;
-}
-
-
-int hic_prep(const command_line_arguements *cmd_args,
-	     hic **hic){
-
-  hic_raw *raw;
-  hic_raw_read(cmd_args->hicRaw_dir,
-	       cmd_args->res,  cmd_args->chr,	       
-	       cmd_args->norm, cmd_args->exp,	       
-	       &raw);
-  
-  show_info(stderr, cmd_args->prog_name,
-	    "Hi-C: loaded Hi-C Raw file and normalization vector(s)");
-
-  if(cmd_args->exec_thread_num >= 1){
-    int i = 0;
-    hic_prep_thread_args *params;
-    pthread_t *threads = NULL;
-
-    params = calloc_errchk(cmd_args->exec_thread_num,			   
-			   sizeof(hic_prep_thread_args),
-			   "calloc: hic_prep_thread_args");
-    threads = calloc_errchk(cmd_args->exec_thread_num,			   
-			    sizeof(pthread_t),
-			    "calloc: threads");
-        
-    /* set variables */
-    for(i = 0; i < cmd_args->exec_thread_num; i++){
-      params[i].thread_id = i;
-      params[i].begin = ((i == 0) ? 0 : params[i - 1].end + 1);
-      params[i].end = ((i == (cmd_args->exec_thread_num - 1)) ?
-		       raw->hic->nrow - 1 :
-		       ((raw->hic->nrow / cmd_args->exec_thread_num) * (i + 1) - 1));
-      params[i].h_invalid = raw->hic->invalid;
-      params[i].h_i = raw->hic->i;
-      params[i].h_j = raw->hic->j;
-      params[i].h_mij = raw->hic->mij;
-      params[i].min_dist = cmd_args->min_size / cmd_args->res;
-      params[i].max_dist = cmd_args->max_size / cmd_args->res;
-      params[i].norm = raw->norm;
-      params[i].exp = raw->exp;
+    for(x = 0; x < data->nrow; x++){
+      order[count[(data->j)[x]]++] = x;
     }
 
-    if(cmd_args->norm != NULL && cmd_args->exp != NULL){
-      for(i = 0; i < cmd_args->exec_thread_num; i++){
-	pthread_create(&threads[i], NULL, 
-		       hic_prep_thread_norm_exp,
-		       (void*)&params[i]);
-      }
-      for(i = 0; i < cmd_args->exec_thread_num; i++){
-	pthread_join(threads[i], NULL);
-      }
-      free(raw->norm);
-      free(raw->exp);
-    }else if(cmd_args->norm != NULL){
-      for(i = 0; i < cmd_args->exec_thread_num; i++){
-	pthread_create(&threads[i], NULL, 
-		       hic_prep_thread_norm,
-		       (void*)&params[i]);
-      }
-      for(i = 0; i < cmd_args->exec_thread_num; i++){
-	pthread_join(threads[i], NULL);
-      }      
-      free(raw->norm);
-    }else if(cmd_args->exp != NULL){
-      for(i = 0; i < cmd_args->exec_thread_num; i++){
-	pthread_create(&threads[i], NULL, 
-		       hic_prep_thread_exp,
-		       (void*)&params[i]);
-      }
-      for(i = 0; i < cmd_args->exec_thread_num; i++){
-	pthread_join(threads[i], NULL);
-      }      
-      free(raw->exp);
-    }else{
-      for(i = 0; i < cmd_args->exec_thread_num; i++){
-	pthread_create(&threads[i], NULL, 
-		       hic_prep_thread,
-		       (void*)&params[i]);
-      }
-      for(i = 0; i < cmd_args->exec_thread_num; i++){
-	pthread_join(threads[i], NULL);
-      }      
+    memset(count, 0, (data->bin_num + 1) * sizeof(unsigned long));
+    for(x = 0; x < data->nrow; x++){
+      count[(data->i)[x] + 1]++;
+    }
+    for(b = 0; b < data->bin_num; b++){
+      count[b + 1] += count[b];
+    }
+    for(x = 0; x < data->nrow; x++){
+      pos[count[(data->i)[order[x]]]++] = order[x];
     }
-    free(threads);
-    free(params);
+    free(order);
   }
-  *hic = raw->hic;
-  free(raw);
-
-  show_info(stderr, cmd_args->prog_name,
-	    "Hi-C: Completed Normalization O/E conversion");
-
-  return 0;
-}
 
-int hic_check_kmer(hic *data,
-		   const unsigned int **kmer_freq,
-		   const char *prog_name){
-  unsigned long x, count = 0;
   for(x = 0; x < data->nrow; x++){
-    if((data->invalid)[x] == 0 && 
-       (kmer_freq[(data->i)[x]] == NULL ||
-	kmer_freq[(data->j)[x]] == NULL)){
-      (data->invalid)[x] = 1;
-      count++;
-    }
+    i_sorted[x] = (data->i)[pos[x]];
+    j_sorted[x] = (data->j)[pos[x]];
+    mij_sorted[x] = (data->mij)[pos[x]];
   }
-  fprintf(stderr, "%s: info: hic_check_kmer: %ld data points eliminated because there is no corresponding k-mer frequency profile\n", 
-	  prog_name, count);
-	    
-  return 0;
-}
-
-int hic_pack(hic *data, 
-	     const char *prog_name){
-  unsigned long x = 0, y = 0;
-  while(x < data->nrow){
-    while((data->invalid)[x++] != 0 && x < data->nrow);
-    while((data->invalid)[x] == 0 && x < data->nrow){
-      (data->invalid)[y] = 0;
-      (data->i)[y] = (data->i)[x];
-      (data->j)[y] = (data->j)[x];
-      (data->mij)[y++] = (data->mij)[x++];
-    }
+  if(data->map == NULL){
+    free(data->i);
+    free(data->j);
+    free(data->mij);
+  }
+  data->i = i_sorted;
+  data->j = j_sorted;
+  data->mij = mij_sorted;
+
+  /* row pointers (count[b] is now the end of bin b) */
+  data->row_ptr = calloc_errchk(data->bin_num + 1, sizeof(unsigned long),
+				"calloc: hic row_ptr");
+  for(b = 0; b < data->bin_num; b++){
+    (data->row_ptr)[b + 1] = count[b];
   }
-  fprintf(stderr, "%s: info: hic_pack: %ld -> %ld\n", 
-	  prog_name, data->nrow, y);
-  data->i = realloc(data->i, y * sizeof(unsigned int));
-  data->j = realloc(data->j, y * sizeof(unsigned int));
-  data->mij = realloc(data->mij, y * sizeof(double));
-  data->invalid = realloc(data->invalid, y * sizeof(unsigned int));
-  data->nrow = y;
+
+  free(count);
+  free(pos);
+
+  fprintf(stderr, "%s: info: hic_block: %ld rows in %ld anchor bins\n", 
+	  prog_name, data->nrow, data->bin_num);
   return 0;
 }
 
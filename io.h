@@ -1,35 +1,245 @@
 #ifndef __io_H__
 #define __io_H__
 
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <string.h>
+#include <errno.h>
+#include <stdint.h>
 #include "hic.h"
 #include "mywc.h"
 #include "calloc_errchk.h"
 
-int read_double(const char *fileName,
-		double **array,
-		unsigned long *len){
-  {
-    *len = mywc(fileName);
-    *array = calloc_errchk(*len, sizeof(double), "error(calloc) readDouble");
-  }
+/**
+ * text input
+ *  files are memory-mapped and parsed in place; numbers go through
+ *  a fast path and fall back to strtod when it does not apply
+ */
 
-  {
-    FILE *fp;
-    unsigned long i = 0;
-    char buf[BUF_SIZE];
+/* map a whole file read-only (*map is NULL for an empty file) */
+int io_map(const char *file,
+	   const char **map,
+	   size_t *map_len){
+  int fd;
+  struct stat stbuf;
 
-    if((fp = fopen(fileName, "r")) == NULL){
-      fprintf(stderr, "error: fopen %s\n%s\n",
-	      fileName, strerror(errno));
+  if((fd = open(file, O_RDONLY)) == -1){
+    fprintf(stderr, "error: open %s\n%s\n",
+	    file, strerror(errno));
+    exit(EXIT_FAILURE);
+  }
+  if(fstat(fd, &stbuf) == -1){
+    fprintf(stderr, "error: fstat %s\n%s\n",
+	    file, strerror(errno));
+    exit(EXIT_FAILURE);
+  }
+  *map_len = stbuf.st_size;
+  *map = NULL;
+  if(*map_len > 0){
+    void *mem;
+    if((mem = mmap(NULL, *map_len, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED){
+      fprintf(stderr, "error: mmap %s\n%s\n",
+	      file, strerror(errno));
       exit(EXIT_FAILURE);
     }
+    madvise(mem, *map_len, MADV_SEQUENTIAL);
+    *map = (const char *)mem;
+  }
+  close(fd);
+  return 0;
+}
 
-    while(fgets(buf, BUF_SIZE, fp) != NULL && i < *len){
-      (*array)[i++] = strtod(buf, NULL);
+int io_unmap(const char *map,
+	     const size_t map_len){
+  if(map != NULL){
+    munmap((void *)map, map_len);
+  }
+  return 0;
+}
+
+/* end of the line starting at p */
+static inline const char *io_eol(const char *p,
+				 const char *end){
+  const char *eol;
+  return ((eol = memchr(p, '\n', end - p)) == NULL) ? end : eol;
+}
+
+/* 1 if [p, eol) has no content (empty or a lone '\r') */
+static inline int io_blank(const char *p,
+			   const char *eol){
+  return (p == eol || (p + 1 == eol && *p == '\r'));
+}
+
+/**
+ * split [map, map + len) into num chunks at line boundaries
+ *  chunk t is [map + offsets[t], map + offsets[t + 1])
+ */
+int io_split_lines(const char *map,
+		   const size_t len,
+		   const int num,
+		   size_t *offsets){
+  int t;
+  const char *nl;
+  offsets[0] = 0;
+  for(t = 1; t < num; t++){
+    offsets[t] = len * t / num;
+    if(offsets[t] < offsets[t - 1]){
+      offsets[t] = offsets[t - 1];
+    }else if(offsets[t] > 0 && map[offsets[t] - 1] != '\n'){
+      nl = memchr(map + offsets[t], '\n', len - offsets[t]);
+      offsets[t] = (nl == NULL) ? len : (size_t)(nl - map) + 1;
     }
+  }
+  offsets[num] = len;
+  return 0;
+}
+
+static inline const char *io_skip_space(const char *p,
+					const char *end){
+  while(p < end && (*p == ' ' || *p == '\t')){
+    p++;
+  }
+  return p;
+}
+
+static inline const char *io_token_end(const char *p,
+				       const char *end){
+  while(p < end && *p != ' ' && *p != '\t' && *p != '\r' && *p != '\n'){
+    p++;
+  }
+  return p;
+}
 
-    fclose(fp);
+/* parse an integer field and advance *p past it */
+static inline long io_parse_long(const char **p,
+				 const char *end){
+  const char *q = io_skip_space(*p, end);
+  long val = 0;
+  int neg = 0;
+  if(q < end && (*q == '-' || *q == '+')){
+    neg = (*q == '-');
+    q++;
+  }
+  while(q < end && (unsigned int)(*q - '0') < 10){
+    val = val * 10 + (*q - '0');
+    q++;
+  }
+  *p = io_token_end(q, end);
+  return neg ? -val : val;
+}
+
+/**
+ * parse a floating point field and advance *p past it
+ *  decimal numbers whose significand fits in 53 bits and whose
+ *  exponent is within 10^22 are converted with one multiplication
+ *  or division of exact values, i.e. with the same (correctly rounded)
+ *  result as strtod; anything else (NaN, long mantissas, ...) is
+ *  handed to strtod
+ */
+double io_parse_double(const char **p,
+		       const char *end){
+  static const double io_pow10[] = {
+    1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+  };
+  const char *s = io_skip_space(*p, end), *q = s, *tok_end;
+  uint64_t mant = 0;
+  int neg = 0, ndigit = 0, nsig = 0, exp10 = 0, fast = 1;
+
+  if(q < end && (*q == '-' || *q == '+')){
+    neg = (*q == '-');
+    q++;
+  }
+  while(q < end && (unsigned int)(*q - '0') < 10){
+    if(nsig < 19){
+      mant = mant * 10 + (*q - '0');
+      nsig += (mant != 0);
+    }else{
+      fast = 0;
+    }
+    ndigit++;
+    q++;
+  }
+  if(q < end && *q == '.'){
+    q++;
+    while(q < end && (unsigned int)(*q - '0') < 10){
+      if(nsig < 19){
+	mant = mant * 10 + (*q - '0');
+	nsig += (mant != 0);
+	exp10--;
+      }else{
+	fast = 0;
+      }
+      ndigit++;
+      q++;
+    }
+  }
+  if(q < end && (*q == 'e' || *q == 'E')){
+    int e = 0, eneg = 0;
+    q++;
+    if(q < end && (*q == '-' || *q == '+')){
+      eneg = (*q == '-');
+      q++;
+    }
+    while(q < end && (unsigned int)(*q - '0') < 10 && e < 10000){
+      e = e * 10 + (*q - '0');
+      q++;
+    }
+    exp10 += eneg ? -e : e;
+  }
+  tok_end = io_token_end(q, end);
+
+  if(fast != 0 && ndigit > 0 && q == tok_end &&
+     mant <= ((uint64_t)1 << 53) && exp10 >= -22 && exp10 <= 22){
+    double val = (double)mant;
+    val = (exp10 < 0) ? val / io_pow10[-exp10] : val * io_pow10[exp10];
+    *p = tok_end;
+    return neg ? -val : val;
+  }
+
+  {
+    char buf[BUF_SIZE];
+    size_t len = tok_end - s;
+    if(len > BUF_SIZE - 1){
+      len = BUF_SIZE - 1;
+    }
+    memcpy(buf, s, len);
+    buf[len] = '\0';
+    *p = tok_end;
+    return strtod(buf, NULL);
+  }
+}
+
+/* read one double per line */
+int read_double(const char *fileName,
+		double **array,
+		unsigned long *len){
+  const char *map, *p, *end, *eol;
+  size_t map_len;
+  unsigned long size = 1024;
+
+  io_map(fileName, &map, &map_len);
+  *len = 0;
+  *array = calloc_errchk(size, sizeof(double), "error(calloc) readDouble");
+
+  p = map;
+  end = map + map_len;
+  while(p < end){
+    eol = io_eol(p, end);
+    if(*len == size){
+      size *= 2;
+      if((*array = realloc(*array, size * sizeof(double))) == NULL){
+	fprintf(stderr, "error(realloc) readDouble\n");
+	exit(EXIT_FAILURE);
+      }
+    }
+    (*array)[(*len)++] = io_parse_double(&p, eol);
+    p = eol + 1;
   }
+  io_unmap(map, map_len);
 
   return 0;
 }
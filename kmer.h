@@ -3,33 +3,77 @@
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <stdint.h>
+#include <math.h>
 #include "calloc_errchk.h"
 
+/**
+ * canonical k-mer pairs
+ *  a pair (l1, m1) and its reverse complement (l2, m2) with
+ *  l2 = rev_comp(m1), m2 = rev_comp(l1) are the same weak learner.
+ *  A canonical pair is identified by (l, c) = (l1, l2) with l <= c,
+ *  i.e. (l1, m1, l2, m2) = (l, rev_comp(c), c, rev_comp(l)), and is
+ *  numbered idx = c (c + 1) / 2 + l. Nothing is stored per pair; the
+ *  k-mers are derived from idx with a table-driven reverse complement.
+ *  Pairs with the same c (same m1 and l2) are consecutive.
+ */
 typedef struct _canonical_kp{
-  unsigned int *l1;
-  unsigned int *m1;
-  unsigned int *l2;
-  unsigned int *m2;
+  unsigned int k;
   unsigned long kmer_num;
   unsigned long kmer_pair_num;
   unsigned long num;
+  /* reverse complements of all 4-mers */
+  unsigned char rc4[256];
 } canonical_kp;
 
-/* compute reverse complement of a given k-mer */
-unsigned long rev_comp(unsigned long kmer, 
-		       const unsigned int k){
-  unsigned int i = 0;
-  unsigned long revComp = 0;
-  kmer = ((~kmer) & ((1 << (2 * k)) - 1));
-  for(i = 0; i <  k; i++){
-    revComp <<= 2;
-    revComp += (kmer & 3);
-    kmer >>= 2;
+/* k-mers of a canonical pair: concat(l2, m2) = rev_comp(concat(l1, m1)) */
+typedef struct _kp_tuple{
+  unsigned int l1;
+  unsigned int m1;
+  unsigned int l2;
+  unsigned int m2;
+} kp_tuple;
+
+/* reverse complement of a k-mer (k <= 16) */
+static inline unsigned int kp_rev_comp(const canonical_kp *kp,
+				       const unsigned long kmer){
+  const uint32_t rc = (((uint32_t)(kp->rc4)[kmer & 0xff] << 24) |
+		       ((uint32_t)(kp->rc4)[(kmer >> 8) & 0xff] << 16) |
+		       ((uint32_t)(kp->rc4)[(kmer >> 16) & 0xff] << 8) |
+		       ((uint32_t)(kp->rc4)[(kmer >> 24) & 0xff]));
+  return (unsigned int)(rc >> (32 - 2 * kp->k));
+}
+
+/* k-mers of the canonical pair idx */
+static inline kp_tuple kp_get(const canonical_kp *kp,
+			      const unsigned long idx){
+  unsigned long c = (unsigned long)((sqrt(8.0 * idx + 1) - 1) / 2), l;
+  kp_tuple tp;
+  while(c * (c + 1) / 2 > idx){
+    c--;
   }
-  return revComp;
+  while((c + 1) * (c + 2) / 2 <= idx){
+    c++;
+  }
+  l = idx - c * (c + 1) / 2;
+  tp.l1 = l;
+  tp.m1 = kp_rev_comp(kp, c);
+  tp.l2 = c;
+  tp.m2 = kp_rev_comp(kp, l);
+  return tp;
+}
+
+/**
+ * rank of the canonical pair idx in the order of the original
+ *  enumeration (l1 * 4^k + m1, increasing), used to break ties
+ */
+static inline unsigned long kp_lex_rank(const canonical_kp *kp,
+					const unsigned long idx){
+  const kp_tuple tp = kp_get(kp, idx);
+  return ((unsigned long)tp.l1 << (2 * kp->k)) | tp.m1;
 }
 
-inline char Binary2char(const long binaryNum){
+static inline char Binary2char(const long binaryNum){
   if(binaryNum == 0){
     return 'A'; 
   }else if(binaryNum == 1){
@@ -45,7 +89,7 @@ inline char Binary2char(const long binaryNum){
 
 int set_kmer_strings(const int k,
 		   char ***kmerStrings){
-  const unsigned long kmerNum = 1 << (2 * k);
+  const unsigned long kmerNum = 1UL << (2 * k);
   int i;
   unsigned long l, m;
   *kmerStrings = calloc_errchk(sizeof(int *), kmerNum, "calloc kmerStrings");
@@ -62,40 +106,22 @@ int set_kmer_strings(const int k,
 
 int set_canonical_kmer_pairs(const unsigned int k,
 			     canonical_kp **kp){
-  {
-    *kp = calloc_errchk(1, sizeof(canonical_kp), "canonical_kp");
-    (*kp)->kmer_num = 1 << (2 * k);
-    (*kp)->kmer_pair_num = 1 << (4 * k);
-    (*kp)->num = (1 << (4 * k - 1)) + (1 << (2 * k - 1));
-    (*kp)->l1 = calloc_errchk((*kp)->num, sizeof(unsigned int), "canonical_kp l1");
-    (*kp)->m1 = calloc_errchk((*kp)->num, sizeof(unsigned int), "canonical_kp m1");
-    (*kp)->l2 = calloc_errchk((*kp)->num, sizeof(unsigned int), "canonical_kp l2");
-    (*kp)->m2 = calloc_errchk((*kp)->num, sizeof(unsigned int), "canonical_kp m2");
+  unsigned int b, i;
+  if(k > 15){
+    fprintf(stderr, "error: set_canonical_kmer_pairs: k = %d exceeds 15\n", k);
+    exit(EXIT_FAILURE);
   }
-
-  {
-    unsigned long lm = 0, revcomp_lm = 0, next = 0;
-    for(lm = 0; lm < (*kp)->kmer_pair_num; lm++){
-      revcomp_lm = rev_comp(lm, 2 * k);
-      if(lm <= revcomp_lm){
-	/**
-	 * where, l2 = rev_comp(m1, k)
-	 *        m2 = rev_comp(l1, k)
-	 * note:
-	 *        concat(l2 + m2) = rev_comp(concat(l1 + m1))
-	 */	
-	((*kp)->l1)[next] = lm / ((*kp)->kmer_num);
-	((*kp)->m1)[next] = lm % ((*kp)->kmer_num);
-	((*kp)->l2)[next] = revcomp_lm / ((*kp)->kmer_num);
-	((*kp)->m2)[next] = revcomp_lm % ((*kp)->kmer_num);
-	next++;
-      }
+  *kp = calloc_errchk(1, sizeof(canonical_kp), "canonical_kp");
+  (*kp)->k = k;
+  (*kp)->kmer_num = 1UL << (2 * k);
+  (*kp)->kmer_pair_num = 1UL << (4 * k);
+  (*kp)->num = (1UL << (4 * k - 1)) + (1UL << (2 * k - 1));
+  for(b = 0; b < 256; b++){
+    for(i = 0; i < 4; i++){
+      ((*kp)->rc4)[b] |= (3 - ((b >> (2 * i)) & 3)) << (2 * (3 - i));
     }
   }
-
   return 0;
 }
 
-
-
 #endif
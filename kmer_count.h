@@ -0,0 +1,297 @@
+#ifndef __KMER_COUNT_H__
+#define __KMER_COUNT_H__
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include "calloc_errchk.h"
+
+/**
+ * k-mer count matrix
+ *  one contiguous row-major arena of bin_num rows x 4^k counts.
+ *  A count takes width bytes (1: saturating at 255, 2 or 4); rows
+ *  are padded to KMER_COUNT_ALIGN bytes. Bins without a profile
+ *  (containing N) have their bit cleared in the validity bitmap.
+ *
+ * For large k (k >= KMER_SPARSE_MIN_K or --sparse) the rows are kept
+ * sparse instead: the k-mers occurring in bin b are
+ * ids[ptr[b]], ..., ids[ptr[b + 1] - 1] in increasing order, with their
+ * counts at the same positions of vals (width bytes each). A 1 kb bin
+ * has at most ~1000 distinct k-mers out of 4^k.
+ */
+
+#define KMER_COUNT_ALIGN 64
+#define KMER_SPARSE_MIN_K 7
+
+typedef struct _kmer_count {
+  unsigned long bin_num;
+  unsigned long kmer_num;
+  /* bytes per count (1, 2 or 4) */
+  unsigned int width;
+  /* bytes per row */
+  size_t row_bytes;
+  /* validity bitmap, (bin_num + 63) / 64 words */
+  uint64_t *valid;
+  /* bin_num * row_bytes bytes (dense) */
+  unsigned char *counts;
+  /* sparse profiles (NULL if dense) */
+  unsigned long *ptr;
+  uint32_t *ids;
+  unsigned char *vals;
+  /* mapping of a cache file (see cache.h) that valid and counts point into */
+  void *map;
+  size_t map_len;
+} kmer_count;
+
+static inline int kmer_count_valid(const kmer_count *kc,
+				   const unsigned long bin){
+  return (bin < kc->bin_num && ((kc->valid[bin >> 6] >> (bin & 63)) & 1));
+}
+
+static inline const unsigned char *kmer_count_row(const kmer_count *kc,
+						  const unsigned long bin){
+  return kc->counts + bin * kc->row_bytes;
+}
+
+/* count stored at position idx of a width-byte array */
+static inline unsigned int kmer_count_at(const unsigned char *array,
+					 const unsigned int width,
+					 const unsigned long idx){
+  switch(width){
+    case 1:
+      return ((const uint8_t *)array)[idx];
+    case 2:
+      return ((const uint16_t *)array)[idx];
+    default:
+      return ((const uint32_t *)array)[idx];
+  }
+}
+
+/* position of kmer in the sparse profile of bin, or -1 if absent */
+static inline long kmer_count_find(const kmer_count *kc,
+				   const unsigned long bin,
+				   const uint32_t kmer){
+  unsigned long lo = kc->ptr[bin], hi = kc->ptr[bin + 1], mid;
+  while(lo < hi){
+    mid = (lo + hi) >> 1;
+    if(kc->ids[mid] < kmer){
+      lo = mid + 1;
+    }else{
+      hi = mid;
+    }
+  }
+  return (lo < kc->ptr[bin + 1] && kc->ids[lo] == kmer) ? (long)lo : -1;
+}
+
+static inline unsigned int kmer_count_get(const kmer_count *kc,
+					  const unsigned long bin,
+					  const unsigned long kmer){
+  const unsigned char *row;
+  if(kc->ids != NULL){
+    long idx = kmer_count_find(kc, bin, kmer);
+    return (idx < 0) ? 0 : kmer_count_at(kc->vals, kc->width, idx);
+  }
+  row = kmer_count_row(kc, bin);
+  switch(kc->width){
+    case 1:
+      return ((const uint8_t *)row)[kmer];
+    case 2:
+      return ((const uint16_t *)row)[kmer];
+    default:
+      return ((const uint32_t *)row)[kmer];
+  }
+}
+
+/**
+ * width (in bytes) for a count width option in bits;
+ * 0 picks the smallest width that holds max_count exactly
+ */
+unsigned int kmer_count_width(const unsigned int bits,
+			      const unsigned long max_count){
+  switch(bits){
+    case 8:
+      return 1;
+    case 16:
+      return 2;
+    case 32:
+      return 4;
+    default:
+      return (max_count <= UINT8_MAX) ? 1 : ((max_count <= UINT16_MAX) ? 2 : 4);
+  }
+}
+
+static inline size_t kmer_count_row_bytes(const unsigned long kmer_num,
+					  const unsigned int width){
+  return (kmer_num * width + KMER_COUNT_ALIGN - 1) & ~((size_t)KMER_COUNT_ALIGN - 1);
+}
+
+int kmer_count_create(const unsigned long bin_num,
+		      const unsigned int k,
+		      const unsigned int width,
+		      kmer_count **kc){
+  size_t bytes;
+
+  *kc = calloc_errchk(1, sizeof(kmer_count), "calloc: kmer_count");
+  (*kc)->bin_num = bin_num;
+  (*kc)->kmer_num = 1UL << (2 * k);
+  (*kc)->width = width;
+  (*kc)->row_bytes = kmer_count_row_bytes((*kc)->kmer_num, width);
+  (*kc)->valid = calloc_errchk((bin_num + 63) / 64 + 1, sizeof(uint64_t),
+			       "calloc: kmer_count->valid");
+
+  bytes = bin_num * (*kc)->row_bytes;
+  if(posix_memalign((void **)&((*kc)->counts), KMER_COUNT_ALIGN,
+		    (bytes > 0) ? bytes : KMER_COUNT_ALIGN) != 0){
+    fprintf(stderr, "error: posix_memalign kmer_count->counts\n");
+    exit(EXIT_FAILURE);
+  }
+  memset((*kc)->counts, 0, bytes);
+  return 0;
+}
+
+static inline void kmer_count_set_valid(kmer_count *kc,
+					const unsigned long bin){
+  __sync_fetch_and_or(&(kc->valid[bin >> 6]), (uint64_t)1 << (bin & 63));
+}
+
+/**
+ * store the touched entries of a row of 32-bit counts (saturating for
+ * narrower widths) into the zeroed row of bin, mark the bin valid and
+ * clear those entries of the source row;
+ * returns the number of saturated counts
+ */
+unsigned long kmer_count_store(kmer_count *kc,
+			       const unsigned long bin,
+			       unsigned int *src,
+			       const uint32_t *touched,
+			       const unsigned long touched_num){
+  unsigned char *row = kc->counts + bin * kc->row_bytes;
+  unsigned long t, saturated = 0;
+  uint32_t kmer;
+
+  switch(kc->width){
+    case 1:
+      for(t = 0; t < touched_num; t++){
+	kmer = touched[t];
+	if(src[kmer] > UINT8_MAX){
+	  ((uint8_t *)row)[kmer] = UINT8_MAX;
+	  saturated++;
+	}else{
+	  ((uint8_t *)row)[kmer] = src[kmer];
+	}
+	src[kmer] = 0;
+      }
+      break;
+    case 2:
+      for(t = 0; t < touched_num; t++){
+	kmer = touched[t];
+	if(src[kmer] > UINT16_MAX){
+	  ((uint16_t *)row)[kmer] = UINT16_MAX;
+	  saturated++;
+	}else{
+	  ((uint16_t *)row)[kmer] = src[kmer];
+	}
+	src[kmer] = 0;
+      }
+      break;
+    default:
+      for(t = 0; t < touched_num; t++){
+	kmer = touched[t];
+	((uint32_t *)row)[kmer] = src[kmer];
+	src[kmer] = 0;
+      }
+  }
+  kmer_count_set_valid(kc, bin);
+  return saturated;
+}
+
+/* growable list of (k-mer, count) entries of sparse profiles */
+typedef struct _kmer_sparse_buf {
+  unsigned long num;
+  unsigned long size;
+  uint32_t *ids;
+  uint32_t *counts;
+} kmer_sparse_buf;
+
+static inline void kmer_sparse_buf_push(kmer_sparse_buf *buf,
+					const uint32_t id,
+					const uint32_t count){
+  if(buf->num == buf->size){
+    buf->size = (buf->size == 0) ? 4096 : 2 * buf->size;
+    if((buf->ids = realloc(buf->ids, buf->size * sizeof(uint32_t))) == NULL ||
+       (buf->counts = realloc(buf->counts, buf->size * sizeof(uint32_t))) == NULL){
+      fprintf(stderr, "error: realloc kmer_sparse_buf\n");
+      exit(EXIT_FAILURE);
+    }
+  }
+  (buf->ids)[buf->num] = id;
+  (buf->counts)[buf->num++] = count;
+}
+
+/* empty sparse table; ptr[b + 1] is set to the length of bin b while counting */
+int kmer_count_create_sparse(const unsigned long bin_num,
+			     const unsigned int k,
+			     const unsigned int width,
+			     kmer_count **kc){
+  *kc = calloc_errchk(1, sizeof(kmer_count), "calloc: kmer_count");
+  (*kc)->bin_num = bin_num;
+  (*kc)->kmer_num = 1UL << (2 * k);
+  (*kc)->width = width;
+  (*kc)->valid = calloc_errchk((bin_num + 63) / 64 + 1, sizeof(uint64_t),
+			       "calloc: kmer_count->valid");
+  (*kc)->ptr = calloc_errchk(bin_num + 1, sizeof(unsigned long),
+			     "calloc: kmer_count->ptr");
+  return 0;
+}
+
+/**
+ * turn the bin lengths in ptr into offsets and allocate ids / vals
+ */
+int kmer_count_sparse_alloc(kmer_count *kc){
+  unsigned long bin;
+  for(bin = 0; bin < kc->bin_num; bin++){
+    kc->ptr[bin + 1] += kc->ptr[bin];
+  }
+  kc->ids = calloc_errchk(kc->ptr[kc->bin_num] + 1, sizeof(uint32_t),
+			  "calloc: kmer_count->ids");
+  kc->vals = calloc_errchk(kc->ptr[kc->bin_num] + 1, kc->width,
+			   "calloc: kmer_count->vals");
+  return 0;
+}
+
+/* store count at position idx of the sparse table, returns 1 if saturated */
+static inline int kmer_count_set_sparse(kmer_count *kc,
+					const unsigned long idx,
+					const uint32_t id,
+					const uint32_t count){
+  kc->ids[idx] = id;
+  switch(kc->width){
+    case 1:
+      ((uint8_t *)kc->vals)[idx] = (count > UINT8_MAX) ? UINT8_MAX : count;
+      return (count > UINT8_MAX);
+    case 2:
+      ((uint16_t *)kc->vals)[idx] = (count > UINT16_MAX) ? UINT16_MAX : count;
+      return (count > UINT16_MAX);
+    default:
+      ((uint32_t *)kc->vals)[idx] = count;
+      return 0;
+  }
+}
+
+int kmer_count_free(kmer_count *kc){
+  if(kc->map == NULL){
+    free(kc->valid);
+    free(kc->counts);
+    free(kc->ptr);
+    free(kc->ids);
+    free(kc->vals);
+  }else{
+    munmap(kc->map, kc->map_len);
+  }
+  free(kc);
+  return 0;
+}
+
+#endif
@@ -0,0 +1,69 @@
+#ifndef __KMER_INDEX_H__
+#define __KMER_INDEX_H__
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include "calloc_errchk.h"
+#include "kmer_count.h"
+
+/**
+ * inverted index of sparse k-mer profiles
+ *  the bins containing k-mer l are
+ *  bins[ptr[l]], ..., bins[ptr[l + 1] - 1] in increasing order.
+ *  Built by a counting sort over the profiles, so the index has
+ *  exactly as many entries as the sparse table.
+ */
+
+typedef struct _kmer_index {
+  unsigned long kmer_num;
+  /* kmer_num + 1 elements */
+  unsigned long *ptr;
+  uint32_t *bins;
+} kmer_index;
+
+int set_kmer_index(const kmer_count *kc,
+		   kmer_index **index){
+  unsigned long bin, e, kmer, *fill;
+
+  if(kc->ids == NULL){
+    fprintf(stderr, "error: set_kmer_index: k-mer table is not sparse\n");
+    exit(EXIT_FAILURE);
+  }
+
+  *index = calloc_errchk(1, sizeof(kmer_index), "calloc: kmer_index");
+  (*index)->kmer_num = kc->kmer_num;
+  (*index)->ptr = calloc_errchk(kc->kmer_num + 1, sizeof(unsigned long),
+				"calloc: kmer_index->ptr");
+  (*index)->bins = calloc_errchk(kc->ptr[kc->bin_num] + 1, sizeof(uint32_t),
+				 "calloc: kmer_index->bins");
+
+  /* posting list lengths, then offsets */
+  for(e = 0; e < kc->ptr[kc->bin_num]; e++){
+    (*index)->ptr[kc->ids[e] + 1]++;
+  }
+  for(kmer = 0; kmer < kc->kmer_num; kmer++){
+    (*index)->ptr[kmer + 1] += (*index)->ptr[kmer];
+  }
+
+  /* bins are visited in increasing order, so every list comes out sorted */
+  fill = calloc_errchk(kc->kmer_num, sizeof(unsigned long),
+		       "calloc: set_kmer_index fill");
+  for(bin = 0; bin < kc->bin_num; bin++){
+    for(e = kc->ptr[bin]; e < kc->ptr[bin + 1]; e++){
+      kmer = kc->ids[e];
+      (*index)->bins[(*index)->ptr[kmer] + fill[kmer]++] = bin;
+    }
+  }
+  free(fill);
+  return 0;
+}
+
+int kmer_index_free(kmer_index *index){
+  free(index->ptr);
+  free(index->bins);
+  free(index);
+  return 0;
+}
+
+#endif
@@ -17,24 +17,31 @@
 #include "constant.h"
 #include "filename.h"
 #include "show_msg.h"
+#include "thread_pool.h"
+#include "numa.h"
 #include "hic.h"
 #include "fasta.h"
+#include "genome.h"
+#include "presence.h"
+#include "kmer_index.h"
+#include "cache.h"
 #include "threshold.h"
+#include "simd.h"
 #include "adaboost.h"
 #include "qp.h"
+#include "qp_solve.h"
 
-int debug_dump_kmer_freq(const unsigned int **kmer_freq,
-			 const unsigned int k,
-			 const int len){
-  int i, j;
-  for(i = 0; i < len; i++){
-    fprintf(stderr, "%d ", i);
+int debug_dump_kmer_freq(const kmer_count *kc,
+			 const unsigned long len){
+  unsigned long i, j;
+  for(i = 0; i < len && i < kc->bin_num; i++){
+    fprintf(stderr, "%ld ", i);
     
-    if(kmer_freq[i] == NULL){
+    if(kmer_count_valid(kc, i) == 0){
       fprintf(stderr, "*\n");
     }else{
-      for(j = 0; j < (1 << (2 * k)); j++){
-	fprintf(stderr, "%d", kmer_freq[i][j] > 0 ? 1 : 0);
+      for(j = 0; j < kc->kmer_num; j++){
+	fprintf(stderr, "%d", kmer_count_get(kc, i, j) > 0 ? 1 : 0);
       }
       fprintf(stderr, "\n");
     }
@@ -47,50 +54,136 @@ int debug_dump_kmer_freq(const unsigned int **kmer_freq,
 int main_sub(const command_line_arguements *args){
 
 #if 0
-  unsigned int **kmer_freq;
+  kmer_count *kc;
 
-  set_kmer_freq(args, &kmer_freq);
+  set_kmer_freq(args, pool, &kc);
   
-  debug_dump_kmer_freq((const unsigned int **)kmer_freq, args->k, 100);
+  debug_dump_kmer_freq(kc, 100);
 #endif
 
-  unsigned int **kmer_freq;
+  kmer_count *kc;
+  kmer_presence *presence = NULL;
+  kmer_index *index = NULL;
   hic *hic;
-  adaboost *model;
+  adaboost **model;
   canonical_kp *kp;
   thresholds *th;
-  double **P, *q;
-  filenames *fnames;
-
-  set_filenames(args, &fnames);
+  double *P, *q, *x, *x0 = NULL, *threshold;
+  filenames *fnames, **fnames_p;
+  char **adaboost_files;
+  thread_pool *pool;
+  unsigned int k;
+
+  /* one set of file names per percentile (shared inputs from the first) */
+  fnames_p = calloc_errchk(args->percentile_num, sizeof(filenames *),
+			   "calloc: fnames_p");
+  for(k = 0; k < args->percentile_num; k++){
+    set_filenames(args, args->percentiles[k], &(fnames_p[k]));
+  }
+  fnames = fnames_p[0];
+  thread_pool_create(args->exec_thread_num, &pool);
+  if(args->exec_mode_numa != 0 && args->chr_num == 0){
+    /* before any data is touched */
+    numa_pin_pool(pool, 0, args->prog_name);
+  }
 
-  set_kmer_freq(args, &kmer_freq);
-  hic_prep(args, &hic);
-  hic_check_kmer(hic, (const unsigned int **)kmer_freq, args->prog_name);
-  hic_pack(hic, args->prog_name);    
+  if(args->chr_num > 0){
+    /* genome mode: per-chromosome jobs, not cached */
+    genome_prep(args, pool, &kc, &hic);
+    if(args->exec_mode_numa != 0){
+      /**
+       * the jobs create their pools from the workers of this pool and
+       * new threads inherit the affinity of their creator, so the
+       * workers are pinned only after the jobs (the arrays AdaBoost
+       * scans are placed or replicated per node later on)
+       */
+      numa_pin_pool(pool, 0, args->prog_name);
+    }
+    if(args->exec_mode_sparse != 0){
+      set_kmer_index(kc, &index);
+    }else{
+      set_kmer_presence(kc, &presence);
+    }
+  }else{
+    if(args->exec_mode_sparse != 0){
+      /* sparse profiles are cheap to recount and are not cached */
+      set_kmer_freq(args, pool, &kc);
+      set_kmer_index(kc, &index);
+    }else{
+      if(args->exec_mode_skip_prep == 0 ||
+	 cache_load_kmer_freq(args, fnames->kmer_freq, &kc) != 0){
+	set_kmer_freq(args, pool, &kc);
+	cache_write_kmer_freq(args, fnames->kmer_freq, kc);
+      }
+      set_kmer_presence(kc, &presence);
+    }
+    if(args->exec_mode_skip_prep == 0 ||
+       cache_load_hic(args, fnames->hic, &hic) != 0){
+      hic_prep(args, pool, kc, &hic);
+      cache_write_hic(args, fnames->hic, hic);
+    }
+  }
+  if(args->exec_mode_block_hic != 0 || args->exec_mode_sparse != 0 ||
+     args->exec_mode_gemm != 0){
+    hic_block(hic, args->prog_name);
+  }
 
 
   set_canonical_kmer_pairs(args->k, &kp);
-  set_thresholds(hic->mij, 1000, hic->nrow, &th);
+  set_thresholds(args, pool, hic->mij, 1000, hic->nrow, &th);
   write_histo(args, th, fnames->histo);
 
+  model = calloc_errchk(args->percentile_num, sizeof(adaboost *),
+		       "calloc: models");
+  threshold = calloc_errchk(args->percentile_num, sizeof(double),
+			    "calloc: thresholds");
+  adaboost_files = calloc_errchk(args->percentile_num, sizeof(char *),
+				 "calloc: adaboost_files");
+  for(k = 0; k < args->percentile_num; k++){
+    threshold[k] = get_threshold(args, th, args->percentiles[k]);
+    adaboost_files[k] = fnames_p[k]->adaboost;
+  }
+
   adaboost_learn(args,
-		 (const unsigned int **)kmer_freq,
+		 pool,
+		 presence,
+		 kc,
+		 index,
 		 hic,
-		 get_threshold(args, th, args->percentile),
+		 args->percentile_num,
+		 threshold,
 		 kp,
-		 &model,
-		 fnames->adaboost);
-  qp_prep(args,
-	  (const unsigned int **)kmer_freq,
-	  hic,
-	  kp,
-	  model,
-	  &P, &q, 
-	  get_threshold(args, th, 0.005),
-	  get_threshold(args, th, 0.995),
-	  fnames->qp_P,
-	  fnames->qp_q);
+		 model,
+		 adaboost_files,
+		 fnames->checkpoint);
+
+  if(args->qp_warm_start_file != NULL){
+    qp_read_warm_start(args->qp_warm_start_file, model[0]->T, &x0);
+  }
+  for(k = 0; k < args->percentile_num; k++){
+    qp_prep(args,
+	    pool,
+	    kc,
+	    hic,
+	    kp,
+	    model[k],
+	    &P, &q, 
+	    get_threshold(args, th, 0.005),
+	    get_threshold(args, th, 0.995),
+	    fnames_p[k]->qp_P,
+	    fnames_p[k]->qp_q);
+    qp_solve(args, pool, model[k]->T, P, q, x0, &x);
+    qp_write_solution(args, model[k], kp, x,
+		      fnames_p[k]->qp_x, fnames_p[k]->results);
+    free(P);
+    free(q);
+    free(x);
+  }
+
+  if(index != NULL){
+    kmer_index_free(index);
+  }
+  thread_pool_destroy(pool);
   return 0;
 }
 
@@ -130,22 +223,47 @@ int check_args(const command_line_arguements *args){
   if(args->iteration_num <= 0){
     show_error(stderr, args->prog_name, "iteration number is not specified");
     errflag++;
-  }else if((unsigned long)(1 << (4 * args->k)) < args->iteration_num){
+  }else if((1UL << (4 * args->k)) < args->iteration_num){
     show_error(stderr, args->prog_name, "iteration number is invalid");
-    fprintf(stderr, "number of weak lerners(T = %ld) exceeds 16^k (%d)\n",
-	    args->iteration_num, 1 << (4 * args->k));
+    fprintf(stderr, "number of weak lerners(T = %ld) exceeds 16^k (%ld)\n",
+	    args->iteration_num, 1UL << (4 * args->k));
     errflag++;
   }else if(errflag == 0){
     fprintf(stderr, "%s: info: number of iterations in AdaBoost: %ld\n",
 	    args->prog_name, args->iteration_num);
   }
 
-  if(args->percentile <= 0){
+  if(args->percentile_num == 0){
     show_error(stderr, args->prog_name, "percentile threshold is not specified");
     errflag++;
-  }else if(errflag == 0){
-    fprintf(stderr, "%s: info: percentile threshold: %e\n",
-	    args->prog_name, args->percentile);
+  }else{
+    unsigned int k, l;
+    for(k = 0; k < args->percentile_num; k++){
+      /* the output files are named after (int)(100 * percentile) */
+      for(l = 0; l < k; l++){
+	if((int)(100 * args->percentiles[l]) == (int)(100 * args->percentiles[k])){
+	  break;
+	}
+      }
+      if(args->percentiles[k] <= 0 || args->percentiles[k] >= 1){
+	show_error(stderr, args->prog_name, "percentile threshold must be in (0, 1)");
+	errflag++;
+      }else if(l < k){
+	show_error(stderr, args->prog_name, "percentile thresholds give the same file names");
+	fprintf(stderr, "%e and %e both map to p%d\n",
+		args->percentiles[l], args->percentiles[k],
+		(int)(100 * args->percentiles[k]));
+	errflag++;
+      }else if(errflag == 0){
+	fprintf(stderr, "%s: info: percentile threshold: %e\n",
+		args->prog_name, args->percentiles[k]);
+      }
+    }
+    if(args->percentile_num > 1 && args->exec_mode_incremental != 0){
+      show_error(stderr, args->prog_name,
+		 "--incremental learns a single model (one percentile)");
+      errflag++;
+    }
   }
 
   if(args->fasta_file != NULL){
@@ -153,6 +271,19 @@ int check_args(const command_line_arguements *args){
 	    args->prog_name, args->fasta_file);
   }
 
+  if(args->chr_num > 0){
+    fprintf(stderr, "%s: info: genome mode: %d chromosomes\n",
+	    args->prog_name, args->chr_num);
+    if(args->exec_mode_skip_prep != 0){
+      show_warning(stderr, args->prog_name,
+		   "cached files are not used in genome mode");
+    }
+    if(args->mem_budget > 0){
+      fprintf(stderr, "%s: info: genome mode: memory budget: %ld MB\n",
+	      args->prog_name, args->mem_budget);
+    }
+  }
+
   if(args->hicRaw_dir != NULL){
     fprintf(stderr, "%s: info: Hi-C raw data directory: %s/\n", 
 	    args->prog_name, args->hicRaw_dir);
@@ -163,6 +294,37 @@ int check_args(const command_line_arguements *args){
 	    args->prog_name, args->kmerFreq_file);
   }
 
+  if(args->count_width != 0 && args->count_width != 8 &&
+     args->count_width != 16 && args->count_width != 32){
+    show_error(stderr, args->prog_name, "count width must be 8, 16 or 32");
+    errflag++;
+  }
+
+  if(args->quantile_eps < 0 || args->quantile_eps >= 1){
+    show_error(stderr, args->prog_name, "quantile error must be in [0, 1)");
+    errflag++;
+  }else if(args->quantile_eps > 0 && errflag == 0){
+    fprintf(stderr, "%s: info: threshold: sampled quantiles, rank error: %e\n",
+	    args->prog_name, args->quantile_eps);
+  }
+
+  if(args->goss_top != 0 || args->goss_other != 0){
+    if(args->goss_top < 0 || args->goss_other <= 0 ||
+       args->goss_top + args->goss_other > 1){
+      show_error(stderr, args->prog_name,
+		 "--goss top,other: fractions with top >= 0, other > 0 and top + other <= 1");
+      errflag++;
+    }else if(args->exec_mode_sparse != 0 || args->exec_mode_incremental != 0 ||
+	     args->percentile_num > 1){
+      show_error(stderr, args->prog_name,
+		 "--goss needs a single dense, non-incremental model");
+      errflag++;
+    }else if(errflag == 0){
+      fprintf(stderr, "%s: info: AdaBoost: row sampling: top %e, other %e\n",
+	      args->prog_name, args->goss_top, args->goss_other);
+    }
+  }
+
   if(args->hic_file != NULL){
     fprintf(stderr, "%s: info: pre-processed Hi-C file: %s\n",
 	    args->prog_name, args->hic_file);
@@ -173,6 +335,16 @@ int check_args(const command_line_arguements *args){
 	    args->prog_name, args->boost_oracle_file);
   }
 
+  if(args->qp_warm_start_file != NULL){
+    fprintf(stderr, "%s: info: warm start for QP: %s\n",
+	    args->prog_name, args->qp_warm_start_file);
+  }
+
+  if(args->exec_mode_qp_dump != 0){
+    fprintf(stderr, "%s: info: QP: P and q are written to files\n",
+	    args->prog_name);
+  }
+
   if(args->output_dir == NULL){
     show_warning(stderr, args->prog_name, "output directory is not specified");
     show_warning(stderr, args->prog_name, "results will be written to stdout");
@@ -181,11 +353,84 @@ int check_args(const command_line_arguements *args){
 	    args->prog_name, args->output_dir);
   }
 
+  if(args->exec_mode_skip_prep != 0){
+    fprintf(stderr, "%s: info: skip preprocessing (use cached files)\n",
+	    args->prog_name);
+  }
+
+  if(args->exec_mode_incremental != 0){
+    fprintf(stderr, "%s: info: AdaBoost: incremental error update\n",
+	    args->prog_name);
+  }
+
+  if(args->checkpoint_interval > 0){
+    fprintf(stderr, "%s: info: AdaBoost: checkpoint every %ld rounds\n",
+	    args->prog_name, args->checkpoint_interval);
+  }
+
+  if(args->exec_mode_resume != 0){
+    fprintf(stderr, "%s: info: AdaBoost: resume from the last checkpoint\n",
+	    args->prog_name);
+  }
+
+  if(args->exec_mode_block_hic != 0){
+    fprintf(stderr, "%s: info: Hi-C: bin-blocked (CSR) layout\n",
+	    args->prog_name);
+  }
+
+  if(args->exec_mode_sparse != 0){
+    fprintf(stderr, "%s: info: sparse k-mer profiles with inverted index\n",
+	    args->prog_name);
+    if(args->exec_mode_incremental != 0){
+      show_error(stderr, args->prog_name,
+		 "--incremental is not available with sparse k-mer profiles (--sparse or large k)");
+      errflag++;
+    }
+  }
+
+  if(args->exec_mode_prune != 0){
+    fprintf(stderr, "%s: info: AdaBoost: branch-and-bound pruning of k-mer pairs\n",
+	    args->prog_name);
+    if(args->exec_mode_incremental != 0){
+      show_error(stderr, args->prog_name,
+		 "--prune is not available with --incremental");
+      errflag++;
+    }
+  }
+
+  if(args->exec_mode_gemm != 0){
+    fprintf(stderr, "%s: info: AdaBoost: errors from k-mer co-occurrence products\n",
+	    args->prog_name);
+    if(args->exec_mode_sparse != 0 || args->exec_mode_incremental != 0 ||
+       args->exec_mode_prune != 0){
+      show_error(stderr, args->prog_name,
+		 "--gemm is not available with sparse k-mer profiles (--sparse or large k), --incremental or --prune");
+      errflag++;
+    }
+  }
+
   if(args->exec_thread_num > 0){	       
     fprintf(stderr, "%s: info: thread num: %d\n", 
 	    args->prog_name, args->exec_thread_num);
   }
 
+  if(simd_init(args->simd) != 0){
+    show_error(stderr, args->prog_name,
+	       "--simd: instruction set is unknown or not supported by this CPU");
+    errflag++;
+  }else if(errflag == 0){
+    fprintf(stderr, "%s: info: vector kernels: %s\n",
+	    args->prog_name, simd_names[simd_level]);
+  }
+
+  if(args->exec_proc_num < 0){
+    show_error(stderr, args->prog_name, "number of processes must be positive");
+    errflag++;
+  }else if(args->exec_proc_num > 1){
+    fprintf(stderr, "%s: info: AdaBoost: %d processes (%d threads in total, at least one each)\n", 
+	    args->prog_name, args->exec_proc_num, args->exec_thread_num);
+  }
+
   if(errflag > 0){
     show_usage(stderr, args->prog_name);
     exit(EXIT_FAILURE);
@@ -202,6 +447,7 @@ int main(int argc, char **argv){
     {"version",       no_argument, NULL, 'v'},
     /* parameters */
     {"chr",           required_argument, NULL, 'c'},
+    {"chrList",       required_argument, NULL, 'L'},
     {"k",             required_argument, NULL, 'k'},
     {"res",           required_argument, NULL, 'r'},
     {"min_size",      required_argument, NULL, 'm'},
@@ -216,20 +462,37 @@ int main(int argc, char **argv){
     {"kmerFreq",      required_argument, NULL, 'f'},
     {"hic",           required_argument, NULL, 'H'},
     {"boostOracle",   required_argument, NULL, 'O'},
+    {"qpWarmStart",   required_argument, NULL, 'W'},
     /* output */
     {"out",           required_argument, NULL, 'o'},
     /* exec_mode */
     {"quite",         no_argument,       NULL, 'q'},
     {"skipPrep",      no_argument,       NULL, 's'},
     {"QPonly",        no_argument,       NULL, 'Q'},
+    {"qpDump",        no_argument,       NULL, 'D'},
+    {"incremental",   no_argument,       NULL, 'I'},
+    {"blockHic",      no_argument,       NULL, 'B'},
+    {"sparse",        no_argument,       NULL, 'S'},
+    {"prune",         no_argument,       NULL, 'X'},
+    {"gemm",          no_argument,       NULL, 'Y'},
+    {"countWidth",    required_argument, NULL, 'w'},
+    {"quantileEps",   required_argument, NULL, 'E'},
+    {"goss",          required_argument, NULL, 'G'},
+    {"gossAudit",     required_argument, NULL, 'A'},
+    {"memBudget",     required_argument, NULL, 'b'},
     {"thread_num",    required_argument, NULL, 't'},
+    {"simd",          required_argument, NULL, 'V'},
+    {"numa",          no_argument,       NULL, 'N'},
+    {"procs",         required_argument, NULL, 'P'},
+    {"checkpoint",    required_argument, NULL, 'C'},
+    {"resume",        no_argument,       NULL, 'U'},
     {0, 0, 0, 0}
   };
 
   args = calloc_errchk(1, sizeof(command_line_arguements), 
 		       "calloc: command line args");
 
-  while((opt = getopt_long(argc, argv, "hvc:r:k:m:M:i:p:n:e:g:R:f:H:O:o:qsQt:",
+  while((opt = getopt_long(argc, argv, "hvc:L:r:k:m:M:i:p:n:e:g:R:f:H:O:W:o:qsQDIBSXYw:E:G:A:b:t:V:NP:C:U",
 			   long_opts, &opt_idx)) != -1){
     switch (opt){
       case 'h': /* help */
@@ -242,6 +505,25 @@ int main(int argc, char **argv){
       case 'c': /* chr */
 	args->chr = atoi(optarg);
 	break;
+      case 'L': /* chrList: comma-separated chromosome names */
+	{
+	  char *tok, *save = NULL;
+	  unsigned int num = 1;
+	  for(tok = optarg; *tok != '\0'; tok++){
+	    num += (*tok == ',');
+	  }
+	  free(args->chr_names);
+	  args->chr_names = calloc_errchk(num, sizeof(char *), "calloc: chr_names");
+	  args->chr_num = 0;
+	  for(tok = strtok_r(optarg, ",", &save); tok != NULL;
+	      tok = strtok_r(NULL, ",", &save)){
+	    if(strncmp(tok, "chr", 3) == 0){
+	      tok += 3;
+	    }
+	    args->chr_names[(args->chr_num)++] = tok;
+	  }
+	}
+	break;
       case 'k': /* k */
 	args->k = atoi(optarg);
 	break;
@@ -257,8 +539,22 @@ int main(int argc, char **argv){
       case 'i': /* iteration_num */
 	args->iteration_num = atol(optarg);
 	break;
-      case 'p': /* percentile */
-	args->percentile = atof(optarg);
+      case 'p': /* percentile, or a comma-separated list */
+	{
+	  char *tok, *save = NULL;
+	  unsigned int num = 1;
+	  for(tok = optarg; *tok != '\0'; tok++){
+	    num += (*tok == ',');
+	  }
+	  free(args->percentiles);
+	  args->percentiles = calloc_errchk(num, sizeof(double), "calloc: percentiles");
+	  args->percentile_num = 0;
+	  for(tok = strtok_r(optarg, ",", &save); tok != NULL;
+	      tok = strtok_r(NULL, ",", &save)){
+	    args->percentiles[(args->percentile_num)++] = atof(tok);
+	  }
+	  args->percentile = (args->percentile_num > 0) ? args->percentiles[0] : 0;
+	}
 	break;
       case 'n': /* norm */
 	args->norm = optarg;
@@ -285,6 +581,9 @@ int main(int argc, char **argv){
       case 'O': /* boostOracle */
 	args->boost_oracle_file = optarg;
 	break;
+      case 'W': /* qpWarmStart */
+	args->qp_warm_start_file = optarg;
+	break;
       /* output */
       case 'o': /* out */
 	args->output_dir = optarg;
@@ -302,9 +601,61 @@ int main(int argc, char **argv){
       case 'Q': /* QPonly */
 	args->exec_mode_QP_only = 1;
 	break;
+      case 'D': /* qpDump */
+	args->exec_mode_qp_dump = 1;
+	break;
+      case 'I': /* incremental */
+	args->exec_mode_incremental = 1;
+	break;
+      case 'B': /* blockHic */
+	args->exec_mode_block_hic = 1;
+	break;
+      case 'S': /* sparse */
+	args->exec_mode_sparse = 1;
+	break;
+      case 'X': /* prune */
+	args->exec_mode_prune = 1;
+	break;
+      case 'Y': /* gemm */
+	args->exec_mode_gemm = 1;
+	break;
+      case 'w': /* countWidth */
+	args->count_width = atoi(optarg);
+	break;
+      case 'E': /* quantileEps */
+	args->quantile_eps = atof(optarg);
+	break;
+      case 'G': /* goss: top,other */
+	{
+	  char *other;
+	  args->goss_top = strtod(optarg, &other);
+	  args->goss_other = (*other == ',') ? atof(other + 1) : 0;
+	}
+	break;
+      case 'A': /* gossAudit */
+	args->goss_audit = atol(optarg);
+	break;
+      case 'b': /* memBudget */
+	args->mem_budget = atol(optarg);
+	break;
       case 't': /* thread_num */
 	args->exec_thread_num = atoi(optarg);
 	break;
+      case 'V': /* simd */
+	args->simd = optarg;
+	break;
+      case 'N': /* numa */
+	args->exec_mode_numa = 1;
+	break;
+      case 'P': /* procs */
+	args->exec_proc_num = atoi(optarg);
+	break;
+      case 'C': /* checkpoint */
+	args->checkpoint_interval = atol(optarg);
+	break;
+      case 'U': /* resume */
+	args->exec_mode_resume = 1;
+	break;
     }
   }
 
@@ -314,6 +665,13 @@ int main(int argc, char **argv){
     strncpy(args->prog_name, argv[0], strlen(argv[0]));
   }
 
+  /* k-mer profiles are sparse for large k */
+  if(args->k >= KMER_SPARSE_MIN_K && args->exec_mode_sparse == 0){
+    args->exec_mode_sparse = 1;
+    fprintf(stderr, "%s: info: k >= %d: switching to sparse k-mer profiles\n",
+	    args->prog_name, KMER_SPARSE_MIN_K);
+  }
+
   /* set exec_thread_num */
   if(args->exec_thread_num <= 0){
     args->exec_thread_num = (int)sysconf(_SC_NPROCESSORS_ONLN);
@@ -26,6 +26,9 @@ norm="KR"
 exp=${norm}
 DATA_DIR_ROOT="/data/yt"
 genome="GRCh37"
+# set RESUME=1 to continue from the checkpoint of an interrupted run
+# (the .ckpt file name does not include iteration_num)
+RESUME=${RESUME:-0}
 
 DIR="/work2/yt/${prog_name}"
 
@@ -65,6 +68,9 @@ make main
 
 if [ ! -e ${output_dir} ]; then mkdir ${output_dir}; fi
 
+resume_opt=""
+if [ "${RESUME}" = "1" ]; then resume_opt="--resume"; fi
+
 ${DIR}/main -v
 
 ${DIR}/main \
@@ -83,16 +89,12 @@ ${DIR}/main \
     --hic ${hic_file} \
     --boostOracle ${boostOracle_file} \
     --out ${output_dir} \
+    --checkpoint 10 \
+    ${resume_opt} \
     --skipPrep 
 
 ${DIR}/histo.sh ${histo}
 
-/work2/yt/QuadProg-example/QPwithFile \
-    ${QP_P} ${QP_q} ${iteration_num} > \
-    ${QP_out}
-
-paste ${QP_out} ${stamps} > ${results}
-
 cat ${results} | grep -v 'GATC' | \
     python ./ctcf_match.py ${k} > ${results_filtered}
     
@@ -0,0 +1,310 @@
+#ifndef __NUMA_H__
+#define __NUMA_H__
+
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include "calloc_errchk.h"
+#include "thread_pool.h"
+
+/**
+ * NUMA-aware execution (--numa)
+ *  the nodes and their CPUs are read from sysfs. The workers of a
+ *  thread pool are pinned to CPUs node after node, so that the slices
+ *  of the per-row arrays of neighbouring workers end up on the same
+ *  node. Memory is placed by first touch: arrays split among the
+ *  workers are touched by the worker that owns the slice, and the
+ *  read-only arrays every worker scans are replicated, one copy per
+ *  node written by a worker of that node.
+ */
+
+#define NUMA_SYSFS "/sys/devices/system/node"
+#define NUMA_LIST_LEN 4096
+
+typedef struct _numa_topology {
+  int node_num;
+  /* cpus of node n: cpus[cpu_ptr[n]], ..., cpus[cpu_ptr[n + 1] - 1] */
+  int *cpu_ptr;
+  int *cpus;
+} numa_topology;
+
+/* arguments for numa_thread_pin and numa_thread_touch */
+typedef struct _numa_thread_args {
+  int cpu;
+  /* byte range to be touched */
+  char *begin;
+  char *end;
+} numa_thread_args;
+
+/* arguments for numa_thread_replicate (one per worker) */
+typedef struct _numa_replicate_args {
+  /* 1 for the first worker of each node */
+  int first;
+  const void *src;
+  size_t bytes;
+  void **dst;
+} numa_replicate_args;
+
+/**
+ * parse a sysfs list ("0-3,8,10-11") into *num integers,
+ * returns -1 on a malformed list
+ */
+int numa_parse_list(const char *list,
+		    int **out,
+		    int *num){
+  const char *p = list;
+  char *q;
+  long lo, hi, v;
+  int size = 0;
+
+  *out = NULL;
+  *num = 0;
+  while(*p != '\0' && *p != '\n'){
+    lo = strtol(p, &q, 10);
+    if(q == p || lo < 0){
+      return -1;
+    }
+    hi = lo;
+    if(*q == '-'){
+      p = q + 1;
+      hi = strtol(p, &q, 10);
+      if(q == p || hi < lo){
+	return -1;
+      }
+    }
+    for(v = lo; v <= hi; v++){
+      if(*num == size){
+	size = (size == 0) ? 64 : 2 * size;
+	if((*out = realloc(*out, size * sizeof(int))) == NULL){
+	  fprintf(stderr, "error: realloc numa list\n");
+	  exit(EXIT_FAILURE);
+	}
+      }
+      (*out)[(*num)++] = (int)v;
+    }
+    p = (*q == ',') ? q + 1 : q;
+  }
+  return 0;
+}
+
+/* read a sysfs list file, returns -1 if it cannot be read */
+int numa_read_list(const char *file,
+		   int **out,
+		   int *num){
+  char buf[NUMA_LIST_LEN];
+  FILE *fp;
+
+  if((fp = fopen(file, "r")) == NULL){
+    return -1;
+  }
+  if(fgets(buf, sizeof(buf), fp) == NULL){
+    fclose(fp);
+    return -1;
+  }
+  fclose(fp);
+  return numa_parse_list(buf, out, num);
+}
+
+/**
+ * nodes with CPUs and their CPUs
+ *  (a single node with all online CPUs if sysfs has no NUMA info)
+ */
+int numa_read_topology(numa_topology **topo){
+  char file[256];
+  int *nodes = NULL, *cpus, node_num = 0, cpu_num, n, c;
+
+  *topo = calloc_errchk(1, sizeof(numa_topology), "calloc: numa_topology");
+  if(numa_read_list(NUMA_SYSFS "/online", &nodes, &node_num) != 0){
+    node_num = 0;
+  }
+  (*topo)->cpu_ptr = calloc_errchk(node_num + 2, sizeof(int), "calloc: numa cpu_ptr");
+  for(n = 0; n < node_num; n++){
+    cpus = NULL;
+    sprintf(file, NUMA_SYSFS "/node%d/cpulist", nodes[n]);
+    if(numa_read_list(file, &cpus, &cpu_num) != 0 || cpu_num == 0){
+      free(cpus);
+      continue;
+    }
+    (*topo)->cpus = realloc((*topo)->cpus,
+			    ((*topo)->cpu_ptr[(*topo)->node_num] + cpu_num) * sizeof(int));
+    if((*topo)->cpus == NULL){
+      fprintf(stderr, "error: realloc numa cpus\n");
+      exit(EXIT_FAILURE);
+    }
+    for(c = 0; c < cpu_num; c++){
+      (*topo)->cpus[(*topo)->cpu_ptr[(*topo)->node_num] + c] = cpus[c];
+    }
+    (*topo)->cpu_ptr[(*topo)->node_num + 1] =
+      (*topo)->cpu_ptr[(*topo)->node_num] + cpu_num;
+    (*topo)->node_num++;
+    free(cpus);
+  }
+  free(nodes);
+
+  if((*topo)->node_num == 0){
+    cpu_num = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    (*topo)->cpus = calloc_errchk(cpu_num, sizeof(int), "calloc: numa cpus");
+    for(c = 0; c < cpu_num; c++){
+      (*topo)->cpus[c] = c;
+    }
+    (*topo)->node_num = 1;
+    (*topo)->cpu_ptr[1] = cpu_num;
+  }
+  return 0;
+}
+
+void numa_free_topology(numa_topology *topo){
+  free(topo->cpu_ptr);
+  free(topo->cpus);
+  free(topo);
+}
+
+/* pin the calling thread to one CPU */
+void *numa_thread_pin(void *args){
+  numa_thread_args *params = (numa_thread_args *)args;
+  unsigned long mask[NUMA_LIST_LEN / (8 * sizeof(unsigned long))];
+
+  if(params->cpu < 0 || params->cpu >= (int)(8 * sizeof(mask))){
+    params->cpu = -1;
+    return NULL;
+  }
+  memset(mask, 0, sizeof(mask));
+  mask[params->cpu / (8 * sizeof(unsigned long))] |=
+    1UL << (params->cpu % (8 * sizeof(unsigned long)));
+  if(syscall(SYS_sched_setaffinity, 0, sizeof(mask), mask) != 0){
+    params->cpu = -1;
+  }
+  return NULL;
+}
+
+/**
+ * pin the workers of pool (worker i to node i * node_num / thread_num)
+ * and set pool->node_of; offset shifts the CPUs within the nodes
+ * (e.g. for the pools of several processes)
+ */
+int numa_pin_pool(thread_pool *pool,
+		  const int offset,
+		  const char *prog_name){
+  numa_topology *topo;
+  numa_thread_args *params;
+  int i, n, first, ncpu, failed = 0;
+
+  numa_read_topology(&topo);
+  params = calloc_errchk(pool->thread_num, sizeof(numa_thread_args),
+			 "calloc: numa_thread_args");
+  free(pool->node_of);
+  pool->node_num = topo->node_num;
+  pool->node_of = calloc_errchk(pool->thread_num, sizeof(int), "calloc: node_of");
+  for(i = 0; i < pool->thread_num; i++){
+    n = (int)((long)i * topo->node_num / pool->thread_num);
+    /* first worker of node n */
+    first = (int)(((long)n * pool->thread_num + topo->node_num - 1) / topo->node_num);
+    ncpu = topo->cpu_ptr[n + 1] - topo->cpu_ptr[n];
+    (pool->node_of)[i] = n;
+    params[i].cpu = topo->cpus[topo->cpu_ptr[n] + (i - first + offset) % ncpu];
+  }
+  thread_pool_exec(pool, numa_thread_pin, params, sizeof(numa_thread_args));
+  for(i = 0; i < pool->thread_num; i++){
+    failed += (params[i].cpu < 0);
+  }
+  if(failed > 0){
+    fprintf(stderr, "%s: warning: NUMA: %d out of %d workers could not be pinned\n",
+	    prog_name, failed, pool->thread_num);
+  }
+  fprintf(stderr, "%s: info: NUMA: %d workers pinned over %d nodes\n",
+	  prog_name, pool->thread_num - failed, topo->node_num);
+  free(params);
+  numa_free_topology(topo);
+  return 0;
+}
+
+/* zero the byte range of the calling worker */
+void *numa_thread_touch(void *args){
+  numa_thread_args *params = (numa_thread_args *)args;
+  if(params->end > params->begin){
+    memset(params->begin, 0, params->end - params->begin);
+  }
+  return NULL;
+}
+
+/**
+ * first touch of copies x n elements of elem_size bytes (copy after copy)
+ *  split among the workers in units of block elements the same way as
+ *  the row blocks of the workers, so that every worker's slice is
+ *  placed on its node (the memory is zeroed)
+ */
+int numa_touch(thread_pool *pool,
+	       void *base,
+	       const size_t elem_size,
+	       const unsigned long n,
+	       const unsigned int copies,
+	       const unsigned long block){
+  const unsigned long block_num = (n + block - 1) / block;
+  numa_thread_args *params;
+  unsigned long begin, end;
+  unsigned int c;
+  int i;
+
+  params = calloc_errchk(pool->thread_num, sizeof(numa_thread_args),
+			 "calloc: numa_thread_args");
+  for(c = 0; c < copies; c++){
+    for(i = 0; i < pool->thread_num; i++){
+      begin = block_num * i / pool->thread_num * block;
+      end = block_num * (i + 1) / pool->thread_num * block;
+      params[i].begin = (char *)base + (c * n + ((begin < n) ? begin : n)) * elem_size;
+      params[i].end = (char *)base + (c * n + ((end < n) ? end : n)) * elem_size;
+    }
+    thread_pool_exec(pool, numa_thread_touch, params, sizeof(numa_thread_args));
+  }
+  free(params);
+  return 0;
+}
+
+/* the first worker of a node makes the node's copy */
+void *numa_thread_replicate(void *args){
+  numa_replicate_args *params = (numa_replicate_args *)args;
+  if(params->first != 0){
+    *(params->dst) = calloc_errchk(params->bytes + 1, 1, "calloc: numa replica");
+    memcpy(*(params->dst), params->src, params->bytes);
+  }
+  return NULL;
+}
+
+/**
+ * one copy of src per node of the pinned pool,
+ * copies[n] is the copy of node n
+ */
+int numa_replicate(thread_pool *pool,
+		   const void *src,
+		   const size_t bytes,
+		   void ***copies){
+  numa_replicate_args *params;
+  int i;
+
+  *copies = calloc_errchk(pool->node_num, sizeof(void *), "calloc: numa copies");
+  params = calloc_errchk(pool->thread_num, sizeof(numa_replicate_args),
+			 "calloc: numa_replicate_args");
+  for(i = 0; i < pool->thread_num; i++){
+    params[i].first = (i == 0 || (pool->node_of)[i] != (pool->node_of)[i - 1]);
+    params[i].src = src;
+    params[i].bytes = bytes;
+    params[i].dst = &((*copies)[(pool->node_of)[i]]);
+  }
+  thread_pool_exec(pool, numa_thread_replicate, params, sizeof(numa_replicate_args));
+  free(params);
+  return 0;
+}
+
+void numa_free_replicas(thread_pool *pool,
+			void **copies){
+  int n;
+  for(n = 0; n < pool->node_num; n++){
+    free(copies[n]);
+  }
+  free(copies);
+}
+
+#endif
@@ -0,0 +1,130 @@
+#ifndef __PRESENCE_H__
+#define __PRESENCE_H__
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include "calloc_errchk.h"
+#include "kmer_count.h"
+
+/**
+ * k-mer presence bitmap
+ *  one bit per k-mer per bin, set iff the k-mer occurs in the bin.
+ *  The weak learners in AdaBoost only depend on whether a k-mer is
+ *  present or not, so this is all they need to read.
+ */
+
+#define PRESENCE_WORD_BITS 64
+#define PRESENCE_WORD_SHIFT 6
+#define PRESENCE_WORD_MASK 63
+
+typedef struct _kmer_presence {
+  unsigned long bin_num;
+  unsigned long kmer_num;
+  /* number of 64-bit words per bin */
+  unsigned long nword;
+  /* array with bin_num * nword elements (bin-major) */
+  uint64_t *bits;
+} kmer_presence;
+
+/* position of a k-mer in a bin's bitmap */
+typedef struct _presence_pos {
+  unsigned long word;
+  unsigned int shift;
+} presence_pos;
+
+static inline presence_pos presence_pos_of(const unsigned long kmer){
+  presence_pos pos;
+  pos.word = kmer >> PRESENCE_WORD_SHIFT;
+  pos.shift = kmer & PRESENCE_WORD_MASK;
+  return pos;
+}
+
+static inline const uint64_t *presence_bin(const kmer_presence *presence,
+					   const unsigned long bin){
+  return presence->bits + bin * presence->nword;
+}
+
+static inline uint64_t presence_test(const uint64_t *bin_bits,
+				     const presence_pos pos){
+  return (bin_bits[pos.word] >> pos.shift) & 1;
+}
+
+/* build presence bitmap from k-mer frequency table */
+int set_kmer_presence(const kmer_count *kc,
+		      kmer_presence **presence){
+  const unsigned long bin_num = kc->bin_num;
+  unsigned long bin, kmer;
+
+  *presence = calloc_errchk(1, sizeof(kmer_presence), "calloc: kmer_presence");
+  (*presence)->bin_num = bin_num;
+  (*presence)->kmer_num = kc->kmer_num;
+  (*presence)->nword =
+    ((*presence)->kmer_num + PRESENCE_WORD_BITS - 1) >> PRESENCE_WORD_SHIFT;
+  (*presence)->bits = calloc_errchk(bin_num * (*presence)->nword,
+				    sizeof(uint64_t),
+				    "calloc: kmer_presence->bits");
+
+  for(bin = 0; bin < bin_num; bin++){
+    if(kmer_count_valid(kc, bin)){
+      uint64_t *row = (*presence)->bits + bin * (*presence)->nword;
+      for(kmer = 0; kmer < (*presence)->kmer_num; kmer++){
+	if(kmer_count_get(kc, bin, kmer) > 0){
+	  row[kmer >> PRESENCE_WORD_SHIFT] |=
+	    ((uint64_t)1 << (kmer & PRESENCE_WORD_MASK));
+	}
+      }
+    }
+  }
+  return 0;
+}
+
+/**
+ * presence bitmap with permuted k-mers: bit c of a bin is set iff
+ * k-mer perm[c] occurs in the bin (e.g. the reverse complements)
+ */
+int set_kmer_presence_perm(const kmer_presence *presence,
+			   const unsigned int *perm,
+			   kmer_presence **out){
+  unsigned long bin, kmer;
+  const uint64_t *src;
+  uint64_t *row;
+
+  *out = calloc_errchk(1, sizeof(kmer_presence), "calloc: kmer_presence");
+  **out = *presence;
+  (*out)->bits = calloc_errchk(presence->bin_num * presence->nword,
+			       sizeof(uint64_t),
+			       "calloc: kmer_presence->bits");
+  for(bin = 0; bin < presence->bin_num; bin++){
+    src = presence_bin(presence, bin);
+    row = (*out)->bits + bin * presence->nword;
+    for(kmer = 0; kmer < presence->kmer_num; kmer++){
+      if(presence_test(src, presence_pos_of(perm[kmer]))){
+	row[kmer >> PRESENCE_WORD_SHIFT] |=
+	  ((uint64_t)1 << (kmer & PRESENCE_WORD_MASK));
+      }
+    }
+  }
+  return 0;
+}
+
+/**
+ * pack a 0/1 vector of length num into 64-bit words
+ * (bits beyond num are left 0)
+ */
+int presence_pack_bits(const unsigned int *vec,
+		       const unsigned long num,
+		       uint64_t **bits){
+  unsigned long x;
+  *bits = calloc_errchk((num + PRESENCE_WORD_BITS - 1) >> PRESENCE_WORD_SHIFT,
+			sizeof(uint64_t), "calloc: packed bits");
+  for(x = 0; x < num; x++){
+    if(vec[x] != 0){
+      (*bits)[x >> PRESENCE_WORD_SHIFT] |=
+	((uint64_t)1 << (x & PRESENCE_WORD_MASK));
+    }
+  }
+  return 0;
+}
+
+#endif
@@ -8,13 +8,64 @@
 #include "hic.h"
 #include "kmer.h"
 #include "adaboost.h"
+#include "simd.h"
+#include "thread_pool.h"
+
+/**
+ * The matrix P is symmetric, so only its upper triangle is stored,
+ * packed row by row in a contiguous array of T(T+1)/2 elements:
+ *  P[i][j] (i <= j) is stored at qp_P_index(T, i, j)
+ */
+static inline unsigned long qp_P_index(const unsigned long T,
+				       const unsigned long i,
+				       const unsigned long j){
+  return i * T - i * (i - 1) / 2 + (j - i);
+}
+
+/* number of Hi-C rows accumulated at once into P as a dense panel */
+#define QP_PANEL_ROWS 32
+/* column tile of P (in elements) kept in cache during a panel update */
+#define QP_COL_TILE 512
+
+/* arguments for function qp_prep_thread */
+typedef struct _qp_prep_thread_args{
+  int thread_id;
+  /* row slice [begin, end) */
+  unsigned long begin;
+  unsigned long end;
+  /* packed slice [P_begin, P_end) for the reduction */
+  unsigned long P_begin;
+  unsigned long P_end;
+  int thread_num;
+  unsigned long T;
+  double mij_min;
+  double mij_max;
+  const kmer_count *kc;
+  const hic *data;
+  /* k-mers of the stamps, arrays with T elements */
+  const unsigned int *l1;
+  const unsigned int *m1;
+  const unsigned int *l2;
+  const unsigned int *m2;
+  /* per-thread partial sums (packed P and q) */
+  double *P_part;
+  double *q_part;
+  /* all partial sums (for the reduction) */
+  double **P_parts;
+  double *P;
+  /* work space */
+  double *panel;
+  unsigned int *anchor_l1;
+  unsigned int *anchor_l2;
+} qp_prep_thread_args;
 
 int qp_show_P(FILE *fp, const unsigned int dim,
-	      double **matrix){
+	      double *matrix){
   unsigned int i, j;
   for(i = 0; i < dim; i++){
     for(j = 0; j < dim; j++){
-      fprintf(fp, "%e\t", matrix[i][j]);
+      fprintf(fp, "%e\t",
+	      matrix[(i <= j) ? qp_P_index(dim, i, j) : qp_P_index(dim, j, i)]);
     }
     fprintf(fp, "\n");
   }
@@ -30,20 +81,108 @@ int qp_show_q(FILE *fp, const unsigned int dim,
   return 0;
 }
 
+/**
+ * P += F^T F for a dense panel F of nrow x T (row-major),
+ * upper triangle only
+ */
+static inline void qp_panel_update(double *P,
+				   const double *panel,
+				   const unsigned long nrow,
+				   const unsigned long T){
+  unsigned long tile, tile_end, i, j, r;
+  double *P_row, f;
+  const double *F_row;
+
+  for(tile = 0; tile < T; tile += QP_COL_TILE){
+    tile_end = (tile + QP_COL_TILE < T) ? tile + QP_COL_TILE : T;
+    for(i = 0; i < tile_end; i++){
+      /* columns max(i, tile) .. tile_end - 1 of row i */
+      j = (i > tile) ? i : tile;
+      P_row = P + qp_P_index(T, i, i) - i;
+      for(r = 0; r < nrow; r++){
+	F_row = panel + r * T;
+	if((f = F_row[i]) != 0){
+	  simd_axpy(P_row + j, F_row + j, f, tile_end - j);
+	}
+      }
+    }
+  }
+}
+
+/* accumulate P and q over the rows [begin, end) */
+void *qp_prep_thread(void *args){
+  qp_prep_thread_args *params = (qp_prep_thread_args *)args;
+  const hic *data = params->data;
+  const kmer_count *kc = params->kc;
+  const unsigned long T = params->T;
+  unsigned long x, stamp, nrow = 0, anchor_bin = 0;
+  int anchor_set = 0;
+  double *F_row;
+
+  for(x = params->begin; x < params->end; x++){
+    if(params->mij_min <= data->mij[x] && data->mij[x] <= params->mij_max){
+      /**
+       * load the anchor bin's frequencies once per anchor bin
+       * (consecutive rows share it in the bin-blocked layout)
+       */
+      if(anchor_set == 0 || data->i[x] != anchor_bin){
+	anchor_bin = data->i[x];
+	anchor_set = 1;
+	for(stamp = 0; stamp < T; stamp++){
+	  (params->anchor_l1)[stamp] = kmer_count_get(kc, anchor_bin, (params->l1)[stamp]);
+	  (params->anchor_l2)[stamp] = kmer_count_get(kc, anchor_bin, (params->l2)[stamp]);
+	}
+      }
+      F_row = params->panel + nrow * T;
+      for(stamp = 0; stamp < T; stamp++){
+	F_row[stamp] = (double)
+	  ((params->anchor_l1)[stamp] * kmer_count_get(kc, data->j[x], (params->m1)[stamp]) +
+	   (params->anchor_l2)[stamp] * kmer_count_get(kc, data->j[x], (params->m2)[stamp]));
+	(params->q_part)[stamp] -= data->mij[x] * F_row[stamp];
+      }
+      if(++nrow == QP_PANEL_ROWS){
+	qp_panel_update(params->P_part, params->panel, nrow, T);
+	nrow = 0;
+      }
+    }
+  }
+  if(nrow > 0){
+    qp_panel_update(params->P_part, params->panel, nrow, T);
+  }
+  return NULL;
+}
+
+/* sum up the partial P's over the packed slice [P_begin, P_end) */
+void *qp_reduce_thread(void *args){
+  qp_prep_thread_args *params = (qp_prep_thread_args *)args;
+  unsigned long idx;
+  int t;
+  for(t = 0; t < params->thread_num; t++){
+    for(idx = params->P_begin; idx < params->P_end; idx++){
+      (params->P)[idx] += (params->P_parts)[t][idx];
+    }
+  }
+  return NULL;
+}
 
 int qp_prep(const command_line_arguements *cmd_args,
-	    const unsigned int **kmer_freq,
+	    thread_pool *pool,
+	    const kmer_count *kc,
 	    hic *data,
 	    const canonical_kp *kp,
 	    adaboost *model,
-	    double ***P,
+	    double **P,
 	    double **q,
 	    double mij_min,
 	    double mij_max,
 	    const char *qp_file_P,
 	    const char *qp_file_q){
-  unsigned long stamp, x, i, j;
-  unsigned int *pair_freq;
+  const unsigned long P_len = model->T * (model->T + 1) / 2;
+  unsigned long stamp, idx;
+  unsigned int *l1, *m1, *l2, *m2;
+  qp_prep_thread_args *params;
+  double **P_parts;
+  int i;
   
   fprintf(stderr, 
 	  "%s: info: QP: QP preparation with %ld variables(k-mer pair stamps)\n",
@@ -51,49 +190,89 @@ int qp_prep(const command_line_arguements *cmd_args,
 
   /* allocate memory */
   {
-    *P = calloc_errchk(model->T, sizeof(double *), "calloc: P");
+    *P = calloc_errchk(P_len, sizeof(double), "calloc: P");
+    *q = calloc_errchk(model->T, sizeof(double), "calloc: q");		       
+    l1 = calloc_errchk(model->T, sizeof(unsigned int), "calloc: QP l1");
+    m1 = calloc_errchk(model->T, sizeof(unsigned int), "calloc: QP m1");
+    l2 = calloc_errchk(model->T, sizeof(unsigned int), "calloc: QP l2");
+    m2 = calloc_errchk(model->T, sizeof(unsigned int), "calloc: QP m2");
     for(stamp = 0; stamp < model->T; stamp++){
-      (*P)[stamp] = calloc_errchk(model->T, sizeof(double), "calloc: P[]");
+      const kp_tuple tp = kp_get(kp, model->axis[stamp]);
+      l1[stamp] = tp.l1;
+      m1[stamp] = tp.m1;
+      l2[stamp] = tp.l2;
+      m2[stamp] = tp.m2;
     }
-    *q = calloc_errchk(model->T, sizeof(double), "calloc: q");		       
-    pair_freq = calloc_errchk(model->T,
-			      sizeof(unsigned int), "calloc: pair_freq");
+    params = calloc_errchk(pool->thread_num, sizeof(qp_prep_thread_args),
+			   "calloc: qp_prep_thread_args");
+    P_parts = calloc_errchk(pool->thread_num, sizeof(double *),
+			    "calloc: P_parts");
+  }
+
+  for(i = 0; i < pool->thread_num; i++){
+    P_parts[i] = calloc_errchk(P_len, sizeof(double), "calloc: P_parts[]");
+    params[i].thread_id = i;
+    params[i].begin = data->nrow * i / pool->thread_num;
+    params[i].end = data->nrow * (i + 1) / pool->thread_num;
+    params[i].P_begin = P_len * i / pool->thread_num;
+    params[i].P_end = P_len * (i + 1) / pool->thread_num;
+    params[i].thread_num = pool->thread_num;
+    params[i].T = model->T;
+    params[i].mij_min = mij_min;
+    params[i].mij_max = mij_max;
+    params[i].kc = kc;
+    params[i].data = data;
+    params[i].l1 = l1;
+    params[i].m1 = m1;
+    params[i].l2 = l2;
+    params[i].m2 = m2;
+    params[i].P_part = P_parts[i];
+    params[i].q_part = calloc_errchk(model->T, sizeof(double),
+				     "calloc: q_part");
+    params[i].P_parts = P_parts;
+    params[i].P = *P;
+    params[i].panel = calloc_errchk(QP_PANEL_ROWS * model->T, sizeof(double),
+				    "calloc: QP panel");
+    params[i].anchor_l1 = calloc_errchk(model->T, sizeof(unsigned int),
+					"calloc: anchor_l1");
+    params[i].anchor_l2 = calloc_errchk(model->T, sizeof(unsigned int),
+					"calloc: anchor_l2");
   }
 
-  for(x = 0; x < data->nrow; x++){
-    if(mij_min <= data->mij[x] && data->mij[x] <= mij_max){
+  thread_pool_exec(pool, qp_prep_thread, params, sizeof(qp_prep_thread_args));
+  thread_pool_exec(pool, qp_reduce_thread, params, sizeof(qp_prep_thread_args));
+
+  {
+    for(i = 0; i < pool->thread_num; i++){
       for(stamp = 0; stamp < model->T; stamp++){
-	pair_freq[stamp] =
-	  kmer_freq[data->i[x]][kp->l1[model->axis[stamp]]] * 
-	  kmer_freq[data->j[x]][kp->m1[model->axis[stamp]]] +
-	  kmer_freq[data->i[x]][kp->l2[model->axis[stamp]]] * 
-	  kmer_freq[data->j[x]][kp->m2[model->axis[stamp]]];
-      }
-      for(i = 0; i < model->T; i++){
-	for(j = 0; j < model->T; j++){
-	  (*P)[i][j] += pair_freq[i] * pair_freq[j];
-	}
-      }
-      for(i = 0; i < model->T; i++){
-	(*q)[i] -= data->mij[x] * pair_freq[i];
+	(*q)[stamp] += (params[i].q_part)[stamp];
       }
+      free(params[i].q_part);
+      free(params[i].panel);
+      free(params[i].anchor_l1);
+      free(params[i].anchor_l2);
+      free(P_parts[i]);
     }
+    free(P_parts);
+    free(params);
+    free(l1);
+    free(m1);
+    free(l2);
+    free(m2);
   }
 
   {
-    for(i = 0; i < model->T; i++){
-      for(j = 0; j < model->T; j++){
-	(*P)[i][j] /= ((data->nrow) * (data->nrow));
-      }
+    for(idx = 0; idx < P_len; idx++){
+      (*P)[idx] /= ((data->nrow) * (data->nrow));
     }
-    for(i = 0; i < model->T; i++){
-      (*q)[i] /= (data->nrow);
+    for(stamp = 0; stamp < model->T; stamp++){
+      (*q)[stamp] /= (data->nrow);
     }
   }
 
 
-  /* write to file OR stderr */
-  {
+  /* the solver works in memory; P and q are written only on request */
+  if(cmd_args->exec_mode_qp_dump != 0){
     if(qp_file_P == NULL || qp_file_q == NULL){
       qp_show_P(stderr, model->T, *P);
       qp_show_q(stderr, model->T, *q);
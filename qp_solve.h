@@ -0,0 +1,306 @@
+#ifndef __QP_SOLVE_H__
+#define __QP_SOLVE_H__
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <math.h>
+#include "constant.h"
+#include "calloc_errchk.h"
+#include "io.h"
+#include "kmer.h"
+#include "adaboost.h"
+#include "qp.h"
+#include "thread_pool.h"
+
+/**
+ * solve the QP prepared by qp_prep
+ *
+ *   minimize 1/2 x^T P x + q^T x  subject to  x >= 0
+ *
+ * with accelerated projected gradient (FISTA with adaptive restart)
+ * on the Jacobi-scaled problem; the matrix-vector products run on the
+ * thread pool. A previous solution can be given as a warm start.
+ */
+
+#define QP_SOLVE_MAX_ITR 100000
+#define QP_SOLVE_TOL 1e-10
+/* check convergence every QP_SOLVE_CHECK iterations */
+#define QP_SOLVE_CHECK 10
+#define QP_SOLVE_POWER_ITR 50
+
+/* arguments for function qp_matvec_thread */
+typedef struct _qp_matvec_thread_args{
+  int thread_id;
+  /* row slice [begin, end) */
+  unsigned long begin;
+  unsigned long end;
+  unsigned long T;
+  /* dense T x T matrix (row-major) */
+  const double *H;
+  const double *v;
+  double *out;
+} qp_matvec_thread_args;
+
+/* out = H v for the rows [begin, end) */
+void *qp_matvec_thread(void *args){
+  qp_matvec_thread_args *params = (qp_matvec_thread_args *)args;
+  unsigned long i, j;
+  const double *H_row;
+  double sum;
+  for(i = params->begin; i < params->end; i++){
+    H_row = params->H + i * params->T;
+    sum = 0;
+    for(j = 0; j < params->T; j++){
+      sum += H_row[j] * (params->v)[j];
+    }
+    (params->out)[i] = sum;
+  }
+  return NULL;
+}
+
+static inline void qp_matvec(thread_pool *pool,
+			     qp_matvec_thread_args *params,
+			     const double *v,
+			     double *out){
+  int i;
+  for(i = 0; i < pool->thread_num; i++){
+    params[i].v = v;
+    params[i].out = out;
+  }
+  thread_pool_exec(pool, qp_matvec_thread, params,
+		   sizeof(qp_matvec_thread_args));
+}
+
+/* read a warm start (one value per line), padded with 0 or truncated to T */
+int qp_read_warm_start(const char *file,
+		       const unsigned long T,
+		       double **x0){
+  double *buf;
+  unsigned long len, i;
+  read_double(file, &buf, &len);
+  *x0 = calloc_errchk(T, sizeof(double), "calloc: QP warm start");
+  for(i = 0; i < T && i < len; i++){
+    (*x0)[i] = buf[i] > 0 ? buf[i] : 0;
+  }
+  free(buf);
+  return 0;
+}
+
+int qp_solve(const command_line_arguements *cmd_args,
+	     thread_pool *pool,
+	     const unsigned long T,
+	     const double *P,
+	     const double *q,
+	     const double *x0,
+	     double **x){
+  unsigned long i, j, itr;
+  double *H, *c, *d, *z, *z_old, *y, *g, L = 0, t = 1, t_new, tol, kkt = 0, dot;
+  qp_matvec_thread_args *params;
+  int k, converged = 0;
+
+  *x = calloc_errchk(T, sizeof(double), "calloc: QP x");
+  H = calloc_errchk(T * T, sizeof(double), "calloc: QP H");
+  c = calloc_errchk(T, sizeof(double), "calloc: QP c");
+  d = calloc_errchk(T, sizeof(double), "calloc: QP d");
+  z = calloc_errchk(T, sizeof(double), "calloc: QP z");
+  z_old = calloc_errchk(T, sizeof(double), "calloc: QP z_old");
+  y = calloc_errchk(T, sizeof(double), "calloc: QP y");
+  g = calloc_errchk(T, sizeof(double), "calloc: QP g");
+
+  /**
+   * Jacobi scaling: x = D z with D = diag(P)^(-1/2),
+   * variables with P_ii = 0 never fire and are fixed to 0
+   */
+  for(i = 0; i < T; i++){
+    d[i] = (P[qp_P_index(T, i, i)] > 0) ? 1 / sqrt(P[qp_P_index(T, i, i)]) : 0;
+  }
+  for(i = 0; i < T; i++){
+    for(j = i; j < T; j++){
+      H[i * T + j] = H[j * T + i] = d[i] * P[qp_P_index(T, i, j)] * d[j];
+    }
+    c[i] = d[i] * q[i];
+    z[i] = (x0 != NULL && d[i] > 0) ? x0[i] / d[i] : 0;
+  }
+
+  params = calloc_errchk(pool->thread_num, sizeof(qp_matvec_thread_args),
+			 "calloc: qp_matvec_thread_args");
+  for(k = 0; k < pool->thread_num; k++){
+    params[k].thread_id = k;
+    params[k].begin = T * k / pool->thread_num;
+    params[k].end = T * (k + 1) / pool->thread_num;
+    params[k].T = T;
+    params[k].H = H;
+  }
+
+  /* step size 1 / L, L: largest eigenvalue of H (power iteration) */
+  {
+    double norm;
+    for(i = 0; i < T; i++){
+      y[i] = 1;
+    }
+    for(itr = 0; itr < QP_SOLVE_POWER_ITR; itr++){
+      qp_matvec(pool, params, y, g);
+      norm = 0;
+      for(i = 0; i < T; i++){
+	norm += g[i] * g[i];
+      }
+      norm = sqrt(norm);
+      if(norm == 0){
+	break;
+      }
+      for(i = 0; i < T; i++){
+	y[i] = g[i] / norm;
+      }
+      L = norm;
+    }
+    /* power iteration underestimates L */
+    L *= 1.05;
+  }
+
+  tol = 0;
+  for(i = 0; i < T; i++){
+    tol = (fabs(c[i]) > tol) ? fabs(c[i]) : tol;
+  }
+  tol *= QP_SOLVE_TOL;
+
+  if(L > 0){
+    for(i = 0; i < T; i++){
+      y[i] = z[i];
+    }
+    for(itr = 0; itr < QP_SOLVE_MAX_ITR; itr++){
+      /* projected gradient step from y */
+      qp_matvec(pool, params, y, g);
+      for(i = 0; i < T; i++){
+	z_old[i] = z[i];
+	z[i] = y[i] - (g[i] + c[i]) / L;
+	if(z[i] < 0 || d[i] == 0){
+	  z[i] = 0;
+	}
+      }
+      /* adaptive restart when the momentum points uphill */
+      dot = 0;
+      for(i = 0; i < T; i++){
+	dot += (y[i] - z[i]) * (z[i] - z_old[i]);
+      }
+      if(dot > 0){
+	t = 1;
+      }
+      t_new = (1 + sqrt(1 + 4 * t * t)) / 2;
+      for(i = 0; i < T; i++){
+	y[i] = z[i] + ((t - 1) / t_new) * (z[i] - z_old[i]);
+      }
+      t = t_new;
+
+      /* KKT residual: max_i |min(z_i, (H z + c)_i)| */
+      if((itr + 1) % QP_SOLVE_CHECK == 0){
+	qp_matvec(pool, params, z, g);
+	kkt = 0;
+	for(i = 0; i < T; i++){
+	  if(d[i] > 0){
+	    dot = (z[i] < g[i] + c[i]) ? z[i] : g[i] + c[i];
+	    kkt = (fabs(dot) > kkt) ? fabs(dot) : kkt;
+	  }
+	}
+	if(kkt <= tol){
+	  converged = 1;
+	  itr++;
+	  break;
+	}
+      }
+    }
+  }else{
+    itr = 0;
+    converged = 1;
+  }
+
+  for(i = 0; i < T; i++){
+    (*x)[i] = d[i] * z[i];
+  }
+
+  if(converged != 0){
+    fprintf(stderr, "%s: info: QP: solver converged in %ld iterations (KKT residual %e)\n",
+	    cmd_args->prog_name, itr, kkt);
+  }else{
+    fprintf(stderr, "%s: warning: QP: solver did not converge in %d iterations (KKT residual %e)\n",
+	    cmd_args->prog_name, QP_SOLVE_MAX_ITR, kkt);
+  }
+
+  free(params);
+  free(H);
+  free(c);
+  free(d);
+  free(z);
+  free(z_old);
+  free(y);
+  free(g);
+  return 0;
+}
+
+int qp_show_x(FILE *fp, const unsigned long dim,
+	      const double *x){
+  unsigned long i;
+  for(i = 0; i < dim; i++){
+    fprintf(fp, "%e\n", x[i]);
+  }
+  return 0;
+}
+
+/* write the solution next to the AdaBoost stamps */
+int qp_show_results(FILE *fp,
+		    const adaboost *model,
+		    const char **kmer_strings,
+		    const canonical_kp *kp,
+		    const double *x){
+  unsigned long t;
+  for(t = 0; t < model->T; t++){
+    fprintf(fp, "%e\t", x[t]);
+    adaboost_show_stamp(fp, model, kmer_strings, kp, t);
+  }
+  return 0;
+}
+
+int qp_write_solution(const command_line_arguements *cmd_args,
+		      const adaboost *model,
+		      const canonical_kp *kp,
+		      const double *x,
+		      const char *qp_file_x,
+		      const char *results_file){
+  char **kmer_strings;
+  set_kmer_strings(cmd_args->k, &kmer_strings);
+
+  if(qp_file_x == NULL || results_file == NULL){
+    qp_show_results(stderr, model, (const char **)kmer_strings, kp, x);
+  }else{
+    FILE *fp;
+    if((fp = fopen(qp_file_x, "w")) == NULL){
+      fprintf(stderr, "error: fopen %s\n%s\n",
+	      qp_file_x, strerror(errno));
+      exit(EXIT_FAILURE);
+    }
+    fprintf(stderr, "%s: info: QP: writing solution to file: %s\n",
+	    cmd_args->prog_name, qp_file_x);
+    qp_show_x(fp, model->T, x);
+    fclose(fp);
+
+    if((fp = fopen(results_file, "w")) == NULL){
+      fprintf(stderr, "error: fopen %s\n%s\n",
+	      results_file, strerror(errno));
+      exit(EXIT_FAILURE);
+    }
+    fprintf(stderr, "%s: info: QP: writing results to file: %s\n",
+	    cmd_args->prog_name, results_file);
+    qp_show_results(fp, model, (const char **)kmer_strings, kp, x);
+    fclose(fp);
+  }
+
+  {
+    unsigned long l;
+    for(l = 0; l < (1UL << (2 * cmd_args->k)); l++){
+      free(kmer_strings[l]);
+    }
+    free(kmer_strings);
+  }
+  return 0;
+}
+
+#endif
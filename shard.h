@@ -0,0 +1,209 @@
+#ifndef __SHARD_H__
+#define __SHARD_H__
+
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <pthread.h>
+#include "calloc_errchk.h"
+
+/**
+ * group of worker processes on one machine (--procs)
+ *  the coordinator (rank 0) forks num - 1 workers that share an
+ *  anonymous shared mapping: a process-shared barrier followed by
+ *  data_size bytes of exchange area. Everything else is a private
+ *  (copy-on-write) copy of the coordinator's memory at fork time.
+ *  Threads do not survive fork, so a worker creates its own thread
+ *  pool if it needs one.
+ *  A worker that dies (crash, OOM kill) would leave the others waiting
+ *  at the barrier forever: the coordinator waits with a timeout and
+ *  checks its workers, and the mutex of the barrier is robust, so a
+ *  worker that dies holding it is noticed too. The coordinator then
+ *  exits, which kills the other workers (PR_SET_PDEATHSIG).
+ */
+
+/* seconds between the checks of the workers while waiting at the barrier */
+#define SHARD_POLL_SEC 1
+
+/* process-shared barrier */
+typedef struct _shard_sync {
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+  int count;
+  unsigned long generation;
+} shard_sync;
+
+typedef struct _shard_group {
+  int num;
+  int rank;
+  /* worker pids (coordinator only) */
+  pid_t *pids;
+  /* shared mapping: barrier, then the exchange area */
+  void *shm;
+  size_t shm_len;
+  shard_sync *sync;
+  void *data;
+} shard_group;
+
+/* offset of the exchange area in the shared mapping */
+static inline size_t shard_data_offset(void){
+  return (sizeof(shard_sync) + 63) & ~((size_t)63);
+}
+
+/* threads of process rank when thread_num threads are split among the group */
+static inline int shard_thread_num(const int thread_num,
+				   const int num,
+				   const int rank){
+  const int share = thread_num * (rank + 1) / num - thread_num * rank / num;
+  return (share > 0) ? share : 1;
+}
+
+int shard_create(const int num,
+		 const size_t data_size,
+		 shard_group **group){
+  pthread_mutexattr_t mattr;
+  pthread_condattr_t cattr;
+
+  *group = calloc_errchk(1, sizeof(shard_group), "calloc: shard_group");
+  (*group)->num = num;
+  (*group)->pids = calloc_errchk(num, sizeof(pid_t), "calloc: shard pids");
+  (*group)->shm_len = shard_data_offset() + data_size;
+  if(((*group)->shm = mmap(NULL, (*group)->shm_len, PROT_READ | PROT_WRITE,
+			   MAP_SHARED | MAP_ANONYMOUS, -1, 0)) == MAP_FAILED){
+    fprintf(stderr, "error: mmap shard_group\n%s\n", strerror(errno));
+    exit(EXIT_FAILURE);
+  }
+  (*group)->sync = (shard_sync *)(*group)->shm;
+  (*group)->data = (char *)(*group)->shm + shard_data_offset();
+
+  pthread_mutexattr_init(&mattr);
+  pthread_condattr_init(&cattr);
+  if(pthread_mutexattr_setpshared(&mattr, PTHREAD_PROCESS_SHARED) != 0 ||
+     pthread_mutexattr_setrobust(&mattr, PTHREAD_MUTEX_ROBUST) != 0 ||
+     pthread_condattr_setpshared(&cattr, PTHREAD_PROCESS_SHARED) != 0 ||
+     pthread_condattr_setclock(&cattr, CLOCK_MONOTONIC) != 0 ||
+     pthread_mutex_init(&((*group)->sync->mutex), &mattr) != 0 ||
+     pthread_cond_init(&((*group)->sync->cond), &cattr) != 0){
+    fprintf(stderr, "error: process-shared barrier\n");
+    exit(EXIT_FAILURE);
+  }
+  pthread_mutexattr_destroy(&mattr);
+  pthread_condattr_destroy(&cattr);
+  return 0;
+}
+
+/* fork the workers; returns the rank of the calling process */
+int shard_fork(shard_group *group){
+  int r;
+  pid_t pid;
+
+  fflush(NULL);
+  for(r = 1; r < group->num; r++){
+    if((pid = fork()) == -1){
+      fprintf(stderr, "error: fork\n%s\n", strerror(errno));
+      exit(EXIT_FAILURE);
+    }else if(pid == 0){
+      /* do not outlive the coordinator */
+      prctl(PR_SET_PDEATHSIG, SIGKILL);
+      group->rank = r;
+      return r;
+    }
+    (group->pids)[r] = pid;
+  }
+  group->rank = 0;
+  return 0;
+}
+
+/* coordinator: exit if a worker has terminated */
+void shard_check(shard_group *group){
+  int r, status;
+
+  for(r = 1; r < group->num; r++){
+    if(waitpid((group->pids)[r], &status, WNOHANG) == (group->pids)[r]){
+      if(WIFSIGNALED(status)){
+	fprintf(stderr, "error: worker process %d was killed by signal %d\n",
+		r, WTERMSIG(status));
+      }else{
+	fprintf(stderr, "error: worker process %d exited early (status %d)\n",
+		r, WEXITSTATUS(status));
+      }
+      exit(EXIT_FAILURE);
+    }
+  }
+}
+
+/* a process of the group died while holding the barrier's mutex */
+static inline void shard_owner_dead(shard_group *group,
+				    const int ret){
+  if(ret == EOWNERDEAD){
+    fprintf(stderr, "error: a process of the group died at the barrier\n");
+    if(group->rank == 0){
+      shard_check(group);
+    }
+    exit(EXIT_FAILURE);
+  }
+}
+
+void shard_barrier(shard_group *group){
+  shard_sync *sync = group->sync;
+  struct timespec deadline;
+  unsigned long generation;
+
+  shard_owner_dead(group, pthread_mutex_lock(&(sync->mutex)));
+  generation = sync->generation;
+  if(++(sync->count) == group->num){
+    sync->count = 0;
+    sync->generation++;
+    pthread_cond_broadcast(&(sync->cond));
+  }else if(group->rank != 0){
+    while(sync->generation == generation){
+      shard_owner_dead(group, pthread_cond_wait(&(sync->cond), &(sync->mutex)));
+    }
+  }else{
+    while(sync->generation == generation){
+      clock_gettime(CLOCK_MONOTONIC, &deadline);
+      deadline.tv_sec += SHARD_POLL_SEC;
+      shard_owner_dead(group, pthread_cond_timedwait(&(sync->cond), &(sync->mutex),
+						     &deadline));
+      if(sync->generation == generation){
+	shard_check(group);
+      }
+    }
+  }
+  pthread_mutex_unlock(&(sync->mutex));
+}
+
+/**
+ * workers exit here; the coordinator waits for them
+ * and releases the group
+ */
+int shard_finish(shard_group *group){
+  int r, status;
+
+  if(group->rank != 0){
+    _exit(EXIT_SUCCESS);
+  }
+  for(r = 1; r < group->num; r++){
+    if(waitpid((group->pids)[r], &status, 0) == -1 ||
+       !WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS){
+      fprintf(stderr, "error: worker process %d failed\n", r);
+      exit(EXIT_FAILURE);
+    }
+  }
+  pthread_mutex_destroy(&(group->sync->mutex));
+  pthread_cond_destroy(&(group->sync->cond));
+  munmap(group->shm, group->shm_len);
+  free(group->pids);
+  free(group);
+  return 0;
+}
+
+#endif
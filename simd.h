@@ -0,0 +1,214 @@
+#ifndef __SIMD_H__
+#define __SIMD_H__
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+/**
+ * vector kernels with runtime dispatch
+ *  the binary is built for the baseline instruction set; the kernels
+ *  for wider vector units are compiled with target attributes and the
+ *  widest one supported by the CPU is picked at startup (CPUID), or the
+ *  one given by --simd. Every variant does the same IEEE operations in
+ *  the same order, so the results do not depend on the machine. With
+ *  FMA in the target (avx2, avx512f) the compiler would fuse a multiply
+ *  and an add into one rounding, so contraction is turned off for the
+ *  kernels (SIMD_TARGET).
+ */
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#define SIMD_X86 1
+#include <immintrin.h>
+#define SIMD_TARGET(isa) __attribute__((target(isa), optimize("fp-contract=off")))
+#endif
+
+#define SIMD_SCALAR 0
+#define SIMD_SSE42 1
+#define SIMD_AVX2 2
+#define SIMD_AVX512 3
+
+static int simd_level = SIMD_SCALAR;
+
+static const char *simd_names[] = {"scalar", "sse4.2", "avx2", "avx512"};
+
+/* widest vector unit of this CPU */
+int simd_detect(void){
+#ifdef SIMD_X86
+  __builtin_cpu_init();
+  if(__builtin_cpu_supports("avx512f")){
+    return SIMD_AVX512;
+  }else if(__builtin_cpu_supports("avx2")){
+    return SIMD_AVX2;
+  }else if(__builtin_cpu_supports("sse4.2")){
+    return SIMD_SSE42;
+  }
+#endif
+  return SIMD_SCALAR;
+}
+
+/**
+ * set simd_level from a name ("auto" or NULL: detect),
+ * returns -1 if the name is unknown or not supported by this CPU
+ */
+int simd_init(const char *name){
+  const int max = simd_detect();
+  int level;
+
+  if(name == NULL || strcmp(name, "auto") == 0){
+    simd_level = max;
+    return 0;
+  }
+  for(level = SIMD_SCALAR; level <= SIMD_AVX512; level++){
+    if(strcmp(name, simd_names[level]) == 0){
+      if(level > max){
+	return -1;
+      }
+      simd_level = level;
+      return 0;
+    }
+  }
+  return -1;
+}
+
+#ifdef SIMD_X86
+SIMD_TARGET("sse4.2")
+static void simd_axpy_sse42(double *y, const double *x,
+			    const double a, const unsigned long n){
+  const __m128d va = _mm_set1_pd(a);
+  unsigned long i = 0;
+  for(; i + 2 <= n; i += 2){
+    _mm_storeu_pd(y + i, _mm_add_pd(_mm_loadu_pd(y + i),
+				    _mm_mul_pd(va, _mm_loadu_pd(x + i))));
+  }
+  for(; i < n; i++){
+    y[i] += a * x[i];
+  }
+}
+
+SIMD_TARGET("avx2")
+static void simd_axpy_avx2(double *y, const double *x,
+			   const double a, const unsigned long n){
+  const __m256d va = _mm256_set1_pd(a);
+  unsigned long i = 0;
+  for(; i + 4 <= n; i += 4){
+    _mm256_storeu_pd(y + i, _mm256_add_pd(_mm256_loadu_pd(y + i),
+					  _mm256_mul_pd(va, _mm256_loadu_pd(x + i))));
+  }
+  for(; i < n; i++){
+    y[i] += a * x[i];
+  }
+}
+
+SIMD_TARGET("avx512f")
+static void simd_axpy_avx512(double *y, const double *x,
+			     const double a, const unsigned long n){
+  const __m512d va = _mm512_set1_pd(a);
+  unsigned long i = 0;
+  for(; i + 8 <= n; i += 8){
+    _mm512_storeu_pd(y + i, _mm512_add_pd(_mm512_loadu_pd(y + i),
+					  _mm512_mul_pd(va, _mm512_loadu_pd(x + i))));
+  }
+  if(i < n){
+    const __mmask8 m = (__mmask8)((1U << (n - i)) - 1);
+    _mm512_mask_storeu_pd(y + i, m,
+			  _mm512_add_pd(_mm512_maskz_loadu_pd(m, y + i),
+					_mm512_mul_pd(va, _mm512_maskz_loadu_pd(m, x + i))));
+  }
+}
+
+SIMD_TARGET("sse4.2")
+static void simd_scale_masked_sse42(double *w, uint64_t mask, const double beta){
+  const __m128d vb = _mm_set1_pd(beta);
+  const __m128i bit = _mm_set_epi64x(2, 1);
+  unsigned int b;
+  __m128d v;
+  for(b = 0; b < 64 && (mask >> b) != 0; b += 2){
+    if(((mask >> b) & 3) != 0){
+      v = _mm_loadu_pd(w + b);
+      _mm_storeu_pd(w + b, _mm_blendv_pd(v, _mm_mul_pd(v, vb),
+					  _mm_castsi128_pd(_mm_cmpeq_epi64(
+					    _mm_and_si128(_mm_set1_epi64x((mask >> b) & 3), bit), bit))));
+    }
+  }
+}
+
+SIMD_TARGET("avx2")
+static void simd_scale_masked_avx2(double *w, uint64_t mask, const double beta){
+  const __m256d vb = _mm256_set1_pd(beta);
+  const __m256i bit = _mm256_set_epi64x(8, 4, 2, 1);
+  unsigned int b;
+  __m256d v;
+  for(b = 0; b < 64 && (mask >> b) != 0; b += 4){
+    if(((mask >> b) & 15) != 0){
+      v = _mm256_loadu_pd(w + b);
+      _mm256_storeu_pd(w + b, _mm256_blendv_pd(v, _mm256_mul_pd(v, vb),
+					       _mm256_castsi256_pd(_mm256_cmpeq_epi64(
+						 _mm256_and_si256(_mm256_set1_epi64x((mask >> b) & 15), bit), bit))));
+    }
+  }
+}
+
+SIMD_TARGET("avx512f")
+static void simd_scale_masked_avx512(double *w, uint64_t mask, const double beta){
+  const __m512d vb = _mm512_set1_pd(beta);
+  unsigned int b;
+  __mmask8 m;
+  for(b = 0; b < 64 && (mask >> b) != 0; b += 8){
+    if((m = (__mmask8)(mask >> b)) != 0){
+      _mm512_mask_storeu_pd(w + b, m,
+			    _mm512_mul_pd(_mm512_maskz_loadu_pd(m, w + b), vb));
+    }
+  }
+}
+#endif
+
+/* y[0..n) += a x[0..n) */
+static inline void simd_axpy(double *y, const double *x,
+			     const double a, const unsigned long n){
+  unsigned long i;
+#ifdef SIMD_X86
+  switch(simd_level){
+    case SIMD_AVX512:
+      simd_axpy_avx512(y, x, a, n);
+      return;
+    case SIMD_AVX2:
+      simd_axpy_avx2(y, x, a, n);
+      return;
+    case SIMD_SSE42:
+      simd_axpy_sse42(y, x, a, n);
+      return;
+  }
+#endif
+  for(i = 0; i < n; i++){
+    y[i] += a * x[i];
+  }
+}
+
+/**
+ * w[b] *= beta for the set bits b of mask
+ *  (all 64 elements of w must be addressable)
+ */
+static inline void simd_scale_masked(double *w, uint64_t mask,
+				     const double beta){
+#ifdef SIMD_X86
+  switch(simd_level){
+    case SIMD_AVX512:
+      simd_scale_masked_avx512(w, mask, beta);
+      return;
+    case SIMD_AVX2:
+      simd_scale_masked_avx2(w, mask, beta);
+      return;
+    case SIMD_SSE42:
+      simd_scale_masked_sse42(w, mask, beta);
+      return;
+  }
+#endif
+  while(mask != 0){
+    w[__builtin_ctzll(mask)] *= beta;
+    mask &= mask - 1;
+  }
+}
+
+#endif
@@ -0,0 +1,118 @@
+#ifndef __THREAD_POOL_H__
+#define __THREAD_POOL_H__
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include "calloc_errchk.h"
+
+/**
+ * persistent pool of worker threads
+ *  - workers are created once and reused for every job
+ *  - a job is a thread function (same signature as for pthread_create)
+ *    together with an array of per-thread argument structs;
+ *    worker i is called with the i-th element of the array
+ *  - thread_pool_exec returns after all workers have finished the job,
+ *    i.e. consecutive jobs are separated by a barrier
+ */
+
+typedef void *(*thread_pool_func)(void *);
+
+typedef struct _thread_pool thread_pool;
+
+typedef struct _thread_pool_worker {
+  thread_pool *pool;
+  int thread_id;
+} thread_pool_worker;
+
+struct _thread_pool {
+  int thread_num;
+  pthread_t *threads;
+  thread_pool_worker *workers;
+  pthread_barrier_t start;
+  pthread_barrier_t finish;
+  /* current job */
+  thread_pool_func func;
+  char *args;
+  size_t args_size;
+  int quit;
+  /* NUMA node of each worker (set by numa_pin_pool, NULL otherwise) */
+  int node_num;
+  int *node_of;
+};
+
+void *thread_pool_main(void *args){
+  thread_pool_worker *worker = (thread_pool_worker *)args;
+  thread_pool *pool = worker->pool;
+
+  while(1){
+    pthread_barrier_wait(&(pool->start));
+    if(pool->quit != 0){
+      break;
+    }
+    (pool->func)(pool->args + (worker->thread_id) * (pool->args_size));
+    pthread_barrier_wait(&(pool->finish));
+  }
+  return NULL;
+}
+
+int thread_pool_create(const int thread_num,
+		       thread_pool **pool){
+  int i, ret;
+
+  *pool = calloc_errchk(1, sizeof(thread_pool), "calloc: thread_pool");
+  (*pool)->thread_num = thread_num;
+  (*pool)->threads = calloc_errchk(thread_num, sizeof(pthread_t),
+				   "calloc: thread_pool->threads");
+  (*pool)->workers = calloc_errchk(thread_num, sizeof(thread_pool_worker),
+				   "calloc: thread_pool->workers");
+
+  /* the calling thread takes part in both barriers */
+  pthread_barrier_init(&((*pool)->start), NULL, thread_num + 1);
+  pthread_barrier_init(&((*pool)->finish), NULL, thread_num + 1);
+
+  for(i = 0; i < thread_num; i++){
+    (*pool)->workers[i].pool = *pool;
+    (*pool)->workers[i].thread_id = i;
+    if((ret = pthread_create(&((*pool)->threads[i]), NULL,
+			     thread_pool_main,
+			     (void *)&((*pool)->workers[i]))) != 0){
+      fprintf(stderr, "error: pthread_create\n%s\n", strerror(ret));
+      exit(EXIT_FAILURE);
+    }
+  }
+  return 0;
+}
+
+/* run func(&args[i]) on worker i for all workers and wait for them */
+int thread_pool_exec(thread_pool *pool,
+		     thread_pool_func func,
+		     void *args,
+		     const size_t args_size){
+  pool->func = func;
+  pool->args = (char *)args;
+  pool->args_size = args_size;
+  pthread_barrier_wait(&(pool->start));
+  pthread_barrier_wait(&(pool->finish));
+  return 0;
+}
+
+int thread_pool_destroy(thread_pool *pool){
+  int i;
+  pool->quit = 1;
+  pthread_barrier_wait(&(pool->start));
+  for(i = 0; i < pool->thread_num; i++){
+    pthread_join(pool->threads[i], NULL);
+  }
+  pthread_barrier_destroy(&(pool->start));
+  pthread_barrier_destroy(&(pool->finish));
+  free(pool->node_of);
+  free(pool->workers);
+  free(pool->threads);
+  free(pool);
+  return 0;
+}
+
+#endif
@@ -3,8 +3,14 @@
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
 #include "constant.h"
+#include "cmd_args.h"
 #include "calloc_errchk.h"
+#include "show_msg.h"
+#include "thread_pool.h"
 
 typedef struct _thresholds {
   unsigned int nclass;
@@ -50,11 +56,142 @@ int double_comp(const void *cmp1,
   } 
 }
 
-int set_thresholds(const double *mij,
+/**
+ * quantile selection
+ *  values are mapped to unsigned keys with the same order. One pass
+ *  builds a histogram of the top THRESHOLD_RADIX_BITS bits of the keys,
+ *  a second pass gathers the keys of the buckets holding a requested
+ *  rank, and only those buckets are sorted (in parallel). The result
+ *  is the same as sorting all values.
+ *
+ * With --quantileEps eps the quantiles are taken from a Bernoulli
+ * sample of ln(2 / THRESHOLD_DELTA) / (2 eps^2) values instead; by the
+ * Dvoretzky-Kiefer-Wolfowitz inequality their ranks are then within
+ * eps * num of the requested ones with probability 1 - THRESHOLD_DELTA.
+ * The sample only depends on the row index, not on the thread number.
+ */
+
+#define THRESHOLD_RADIX_BITS 16
+#define THRESHOLD_BUCKET_NUM (1UL << THRESHOLD_RADIX_BITS)
+#define THRESHOLD_DELTA 0.01
+
+typedef struct _threshold_thread_args {
+  int thread_id;
+  /* rows [begin, end) */
+  unsigned long begin;
+  unsigned long end;
+  const double *mij;
+  /* rows x with threshold_hash(x) < sample_cut are used (all if sample_all) */
+  int sample_all;
+  uint64_t sample_cut;
+  /* bucket sizes, then write positions of the target buckets */
+  unsigned long *hist;
+  const unsigned char *target;
+  uint64_t *keys;
+  double max;
+  /* sort phase: next target bucket, and their ranges in keys */
+  unsigned long *next_bucket;
+  unsigned long bucket_num;
+  const unsigned long *bucket_begin;
+  const unsigned long *bucket_end;
+} threshold_thread_args;
+
+static inline uint64_t threshold_key(const double d){
+  uint64_t u;
+  memcpy(&u, &d, sizeof(uint64_t));
+  return (u >> 63) ? ~u : (u | ((uint64_t)1 << 63));
+}
+
+static inline double threshold_value(const uint64_t key){
+  uint64_t u = (key >> 63) ? (key & ~((uint64_t)1 << 63)) : ~key;
+  double d;
+  memcpy(&d, &u, sizeof(double));
+  return d;
+}
+
+/* splitmix64 */
+static inline uint64_t threshold_hash(uint64_t x){
+  x += 0x9e3779b97f4a7c15ULL;
+  x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+  return x ^ (x >> 31);
+}
+
+static inline int threshold_sampled(const threshold_thread_args *params,
+				    const unsigned long x){
+  return params->sample_all || threshold_hash(x) < params->sample_cut;
+}
+
+int uint64_comp(const void *cmp1,
+		const void *cmp2){
+  uint64_t u1 = *((const uint64_t *)cmp1);
+  uint64_t u2 = *((const uint64_t *)cmp2);
+  return (u1 > u2) - (u1 < u2);
+}
+
+void *threshold_thread_hist(void *args){
+  threshold_thread_args *params = (threshold_thread_args *)args;
+  unsigned long x;
+
+  if(params->begin == params->end){
+    return NULL;
+  }
+  params->max = params->mij[params->begin];
+  for(x = params->begin; x < params->end; x++){
+    if(params->mij[x] > params->max){
+      params->max = params->mij[x];
+    }
+    if(threshold_sampled(params, x)){
+      (params->hist)[threshold_key(params->mij[x]) >> (64 - THRESHOLD_RADIX_BITS)]++;
+    }
+  }
+  return NULL;
+}
+
+void *threshold_thread_gather(void *args){
+  threshold_thread_args *params = (threshold_thread_args *)args;
+  unsigned long x, bucket;
+  uint64_t key;
+
+  for(x = params->begin; x < params->end; x++){
+    if(threshold_sampled(params, x)){
+      key = threshold_key(params->mij[x]);
+      bucket = key >> (64 - THRESHOLD_RADIX_BITS);
+      if(params->target[bucket]){
+	params->keys[(params->hist)[bucket]++] = key;
+      }
+    }
+  }
+  return NULL;
+}
+
+void *threshold_thread_sort(void *args){
+  threshold_thread_args *params = (threshold_thread_args *)args;
+  unsigned long b;
+
+  while((b = __sync_fetch_and_add(params->next_bucket, 1)) < params->bucket_num){
+    qsort(params->keys + params->bucket_begin[b],
+	  params->bucket_end[b] - params->bucket_begin[b],
+	  sizeof(uint64_t), uint64_comp);
+  }
+  return NULL;
+}
+
+int set_thresholds(const command_line_arguements *cmd_args,
+		   thread_pool *pool,
+		   const double *mij,
 		   const unsigned int nclass,
 		   const unsigned long num,
 		   thresholds **t){
-  double *cpy;
+  threshold_thread_args *params;
+  unsigned long *rank, *count, *start, *bucket_begin, *bucket_end;
+  unsigned long sample_num = 0, target_num = 0, total, b, next_bucket = 0;
+  unsigned char *target;
+  unsigned int class;
+  uint64_t *keys;
+  double max;
+  int i, thread_num = pool->thread_num;
+
   /* allocate memory */
   {
     *t = calloc_errchk(1, sizeof(thresholds), "calloc thresholds");
@@ -62,25 +199,156 @@ int set_thresholds(const double *mij,
 					  "calloc: thresholds->representatives");
     (*t)->nclass = nclass;
   }
-  /* copy and sort */
-  {
-    unsigned long i;
-    cpy = calloc_errchk(num, sizeof(double), "calloc: cpy");
-    for(i = 0; i < num; i++){
-      cpy[i] = mij[i];
-    }   
-    qsort(cpy, num, sizeof(double), double_comp);
+  if(num == 0){
+    show_error(stderr, cmd_args->prog_name, "threshold: no Hi-C contacts");
+    exit(EXIT_FAILURE);
+  }
+  if((unsigned long)thread_num > num){
+    thread_num = num;
+  }
+
+  params = calloc_errchk(pool->thread_num, sizeof(threshold_thread_args),
+			 "calloc: threshold_thread_args");
+  target = calloc_errchk(THRESHOLD_BUCKET_NUM, sizeof(unsigned char),
+			 "calloc: threshold target");
+  for(i = 0; i < pool->thread_num; i++){
+    params[i].thread_id = i;
+    params[i].begin = (i < thread_num) ? num * i / thread_num : num;
+    params[i].end = (i < thread_num) ? num * (i + 1) / thread_num : num;
+    params[i].mij = mij;
+    params[i].sample_all = 1;
+    params[i].hist = calloc_errchk(THRESHOLD_BUCKET_NUM, sizeof(unsigned long),
+				   "calloc: threshold hist");
+    params[i].target = target;
+    params[i].next_bucket = &next_bucket;
+  }
+  if(cmd_args->quantile_eps > 0){
+    const double m = ceil(log(2 / THRESHOLD_DELTA) /
+			  (2 * cmd_args->quantile_eps * cmd_args->quantile_eps));
+    if(m < num){
+      for(i = 0; i < pool->thread_num; i++){
+	params[i].sample_all = 0;
+	params[i].sample_cut = (uint64_t)(m / num * 18446744073709551616.0);
+      }
+    }
+  }
+
+  /* histogram of the leading key bits */
+  thread_pool_exec(pool, threshold_thread_hist,
+		   params, sizeof(threshold_thread_args));
+  max = params[0].max;
+  for(i = 1; i < thread_num; i++){
+    if(params[i].max > max){
+      max = params[i].max;
+    }
+  }
+  count = calloc_errchk(THRESHOLD_BUCKET_NUM + 1, sizeof(unsigned long),
+			"calloc: threshold count");
+  for(b = 0; b < THRESHOLD_BUCKET_NUM; b++){
+    for(i = 0; i < pool->thread_num; i++){
+      count[b] += (params[i].hist)[b];
+    }
+    sample_num += count[b];
   }
+  if(sample_num == 0){
+    /* (tiny) sample came out empty, use all rows */
+    for(i = 0; i < pool->thread_num; i++){
+      params[i].sample_all = 1;
+      memset(params[i].hist, 0, THRESHOLD_BUCKET_NUM * sizeof(unsigned long));
+    }
+    thread_pool_exec(pool, threshold_thread_hist,
+		     params, sizeof(threshold_thread_args));
+    memset(count, 0, (THRESHOLD_BUCKET_NUM + 1) * sizeof(unsigned long));
+    for(b = 0; b < THRESHOLD_BUCKET_NUM; b++){
+      for(i = 0; i < pool->thread_num; i++){
+	count[b] += (params[i].hist)[b];
+      }
+      sample_num += count[b];
+    }
+  }
+
+  /* requested ranks and the buckets holding them */
+  rank = calloc_errchk(nclass, sizeof(unsigned long), "calloc: threshold rank");
+  for(class = 0; class < nclass; class++){
+    rank[class] = (unsigned long)(1.0 * sample_num * class / nclass + 0.5);
+    if(rank[class] >= sample_num){
+      rank[class] = sample_num - 1;
+    }
+  }
+  start = calloc_errchk(THRESHOLD_BUCKET_NUM + 1, sizeof(unsigned long),
+			"calloc: threshold start");
+  for(b = 0; b < THRESHOLD_BUCKET_NUM; b++){
+    start[b + 1] = start[b] + count[b];
+  }
+  for(class = 0, b = 0; class < nclass; class++){
+    while(start[b + 1] <= rank[class]){
+      b++;
+    }
+    target[b] = 1;
+  }
+
+  /* gather the target buckets (in thread order within a bucket) */
+  bucket_begin = calloc_errchk(nclass, sizeof(unsigned long),
+			       "calloc: threshold bucket_begin");
+  bucket_end = calloc_errchk(nclass, sizeof(unsigned long),
+			     "calloc: threshold bucket_end");
+  total = 0;
+  for(b = 0; b < THRESHOLD_BUCKET_NUM; b++){
+    if(target[b]){
+      bucket_begin[target_num] = total;
+      for(i = 0; i < pool->thread_num; i++){
+	count[b] = (params[i].hist)[b];
+	(params[i].hist)[b] = total;
+	total += count[b];
+      }
+      bucket_end[target_num++] = total;
+    }
+  }
+  keys = calloc_errchk(total + 1, sizeof(uint64_t), "calloc: threshold keys");
+  for(i = 0; i < pool->thread_num; i++){
+    params[i].keys = keys;
+    params[i].bucket_num = target_num;
+    params[i].bucket_begin = bucket_begin;
+    params[i].bucket_end = bucket_end;
+  }
+  thread_pool_exec(pool, threshold_thread_gather,
+		   params, sizeof(threshold_thread_args));
+  thread_pool_exec(pool, threshold_thread_sort,
+		   params, sizeof(threshold_thread_args));
+
+  /* rank r lies in keys at r - (ranks before its bucket) + bucket offset */
   {
-    unsigned int class;
-    unsigned long index;
-    for(class = 0; class < nclass; class++){
-      index = (int)(1.0 * num * class / nclass + 0.5);
-      (*t)->representatives[class] = cpy[index];
+    unsigned long t_idx = 0;
+    for(class = 0, b = 0; class < nclass; class++){
+      while(start[b + 1] <= rank[class]){
+	if(target[b]){
+	  t_idx++;
+	}
+	b++;
+      }
+      (*t)->representatives[class] =
+	threshold_value(keys[bucket_begin[t_idx] + rank[class] - start[b]]);
     }
-    (*t)->representatives[nclass] = cpy[num - 1];
+    (*t)->representatives[nclass] = max;
   }
-  free(cpy);
+
+  if(sample_num < num){
+    fprintf(stderr, "%s: info: threshold: quantiles from a sample of %ld out of %ld contacts (rank error <= %e with probability %.2f)\n",
+	    cmd_args->prog_name, sample_num, num,
+	    sqrt(log(2 / THRESHOLD_DELTA) / (2.0 * sample_num)), 1 - THRESHOLD_DELTA);
+  }
+
+  for(i = 0; i < pool->thread_num; i++){
+    free(params[i].hist);
+  }
+  free(params);
+  free(target);
+  free(count);
+  free(start);
+  free(rank);
+  free(bucket_begin);
+  free(bucket_end);
+  free(keys);
   return 0;
 }
 